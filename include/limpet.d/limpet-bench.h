@@ -0,0 +1,258 @@
+/*
+ * Microbenchmarks, defined with LIMPET_BENCH. A benchmark runs in the test
+ * process like any other test. Its loop is run with an iteration count
+ * that is scaled up until one run takes a fair share of LIMPET_BENCH_TIME.
+ * The runs made while scaling also warm up caches and branch predictors.
+ * Then __LIMPET_BENCH_SAMPLES runs are timed, giving a time per iteration
+ * for each, and the results are passed back to the process running the
+ * tests to be printed in the test trailer and reports. If the results of
+ * an earlier build are known, the median is compared with theirs to catch
+ * regressions.
+ */
+
+#ifndef _LIMPET_BENCH_H_
+#define _LIMPET_BENCH_H_
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Number of timed runs of each benchmark
+ */
+#define __LIMPET_BENCH_SAMPLES  10
+
+/*
+ * Most by which the iteration count is multiplied while scaling it up
+ */
+#define __LIMPET_BENCH_MAX_GROWTH   10.0
+
+/*
+ * Most iterations a benchmark is scaled up to. Even the cheapest loop body
+ * takes a good part of a nanosecond, so a loop that runs this many times
+ * without taking its share of LIMPET_BENCH_TIME must have had its body
+ * optimized away.
+ */
+#define __LIMPET_BENCH_MAX_ITERATIONS   1e12
+
+/*
+ * A slowdown is only a regression if it is more than this many times the
+ * sum of the spreads of the two sets of samples. The median of ten samples
+ * varies by about 0.6 times their median absolute deviation, so this keeps
+ * noise from being taken for a regression.
+ */
+#define __LIMPET_BENCH_NOISE    2.0
+
+/*
+ * State of the benchmark running in this process
+ * start - time at which LIMPET_BENCH_LOOP started
+ * elapsed - number of seconds the last LIMPET_BENCH_LOOP took
+ * looped - true once LIMPET_BENCH_LOOP has finished
+ */
+struct __limpet_bench_state {
+    double  start;
+    double  elapsed;
+    bool    looped;
+};
+
+static struct __limpet_bench_state __limpet_bench_state;
+
+/*
+ * Called by LIMPET_BENCH_LOOP before the first iteration
+ *
+ * Returns: zero, the first value of the iteration counter
+ */
+static unsigned long long __limpet_bench_start(void)
+    __LIMPET_UNUSED;
+static unsigned long long __limpet_bench_start(void) {
+    __limpet_bench_state.start = __limpet_now();
+    return 0;
+}
+
+/*
+ * Called by LIMPET_BENCH_LOOP after the last iteration
+ *
+ * Returns: false, to end the loop
+ */
+static bool __limpet_bench_stop(void)
+    __LIMPET_UNUSED;
+static bool __limpet_bench_stop(void) {
+    __limpet_bench_state.elapsed = __limpet_now() -
+        __limpet_bench_state.start;
+    __limpet_bench_state.looped = true;
+    return false;
+}
+
+/*
+ * Run the benchmark once
+ * iterations - number of times to run the body of LIMPET_BENCH_LOOP
+ *
+ * Returns: the number of seconds the loop took
+ */
+static double __limpet_bench_once(struct __limpet_test *test,
+    void (*func)(unsigned long long), unsigned long long iterations) {
+    __limpet_bench_state.looped = false;
+    (*func)(iterations);
+
+    if (!__limpet_bench_state.looped) {
+        __limpet_fail("Benchmark %s must use LIMPET_BENCH_LOOP\n",
+            test->name);
+    }
+
+    return __limpet_bench_state.elapsed;
+}
+
+static int __limpet_compare_doubles(const void *a, const void *b) {
+    double da = *(const double *)a;
+    double db = *(const double *)b;
+
+    return da < db ? -1 : da > db;
+}
+
+/*
+ * Sort an array of n values and return the median
+ */
+static double __limpet_median(double *values, size_t n) {
+    qsort(values, n, sizeof(values[0]), __limpet_compare_doubles);
+    return (values[(n - 1) / 2] + values[n / 2]) / 2;
+}
+
+/*
+ * Running in the context of the test process, run a benchmark and store
+ * its results where the process running the tests can see them
+ */
+static void __limpet_run_bench(struct __limpet_test *test,
+    void (*func)(unsigned long long)) __LIMPET_UNUSED;
+static void __limpet_run_bench(struct __limpet_test *test,
+    void (*func)(unsigned long long)) {
+    struct __limpet_bench_result result;
+    double samples[__LIMPET_BENCH_SAMPLES];
+    double deviations[__LIMPET_BENCH_SAMPLES];
+    double sample_time;
+    double elapsed;
+    double sum;
+    unsigned long long iterations;
+    size_t i;
+
+    /*
+     * Scaling up the iteration count gets one share of the time and each
+     * sample gets another
+     */
+    sample_time = test->params->bench_time / (__LIMPET_BENCH_SAMPLES + 1);
+
+    iterations = 1;
+    for (;;) {
+        double growth;
+
+        elapsed = __limpet_bench_once(test, func, iterations);
+        if (elapsed >= sample_time) {
+            break;
+        }
+
+        /*
+         * Aim a little past the sample time, so that noise in short runs
+         * doesn't leave us just short of it
+         */
+        growth = elapsed <= 0 ? __LIMPET_BENCH_MAX_GROWTH :
+            1.4 * sample_time / elapsed;
+        if (growth > __LIMPET_BENCH_MAX_GROWTH) {
+            growth = __LIMPET_BENCH_MAX_GROWTH;
+        } else if (growth < 2) {
+            growth = 2;
+        }
+        if (iterations * growth > __LIMPET_BENCH_MAX_ITERATIONS) {
+            __limpet_fail("Benchmark %s would need more than %g "
+                "iterations to take %g seconds: loop body appears to be "
+                "optimized away\n", test->name,
+                __LIMPET_BENCH_MAX_ITERATIONS, sample_time);
+        }
+        iterations = (unsigned long long)(iterations * growth) + 1;
+    }
+
+    sum = 0;
+    for (i = 0; i < __LIMPET_BENCH_SAMPLES; i++) {
+        elapsed = __limpet_bench_once(test, func, iterations);
+        samples[i] = elapsed * 1e9 / iterations;
+        sum += samples[i];
+    }
+
+    memset(&result, 0, sizeof(result));
+    result.iterations = iterations;
+    result.samples = __LIMPET_BENCH_SAMPLES;
+    result.mean = sum / __LIMPET_BENCH_SAMPLES;
+    result.median = __limpet_median(samples, __LIMPET_BENCH_SAMPLES);
+    result.min = samples[0];
+    result.max = samples[__LIMPET_BENCH_SAMPLES - 1];
+
+    /*
+     * The spread is the median absolute deviation, which, unlike the
+     * standard deviation, isn't thrown off by the odd sample that was
+     * interrupted
+     */
+    for (i = 0; i < __LIMPET_BENCH_SAMPLES; i++) {
+        deviations[i] = samples[i] > result.median ?
+            samples[i] - result.median : result.median - samples[i];
+    }
+    result.mad = __limpet_median(deviations, __LIMPET_BENCH_SAMPLES);
+
+    if (test->results != NULL) {
+        test->results->bench = result;
+    }
+}
+
+/*
+ * Print the results of a benchmark, for example:
+ *  12.4 ns/op, median 12.3 ns/op, spread +-1.2%, min 12.1 ns/op,
+ *      max 13.0 ns/op (10 samples of 4000001 iterations)
+ * The spread is the median absolute deviation as a percentage of the
+ * median.
+ */
+static void __limpet_print_bench(const struct __limpet_bench_result *bench) {
+    __limpet_printf("%.4g ns/op, median %.4g ns/op, spread +-%.2g%%, "
+        "min %.4g ns/op, max %.4g ns/op (%u samples of %llu iterations)",
+        bench->mean, bench->median,
+        bench->median == 0 ? 0.0 : 100 * bench->mad / bench->median,
+        bench->min, bench->max, bench->samples, bench->iterations);
+}
+
+/*
+ * Returns: true if the test is a benchmark that produced results and has
+ *      a baseline to compare them with
+ */
+static bool __limpet_has_baseline(struct __limpet_test *test) {
+    return __limpet_is_bench(test) && test->baseline != NULL;
+}
+
+/*
+ * Returns: the change in the median time of a benchmark from that of its
+ *      baseline, as a percentage of the baseline's
+ */
+static double __limpet_bench_change(struct __limpet_test *test) {
+    double base = test->baseline->bench.median;
+
+    return base == 0 ? 0.0 : 100 * (test->results->bench.median - base) / base;
+}
+
+/*
+ * Returns: true if a benchmark is slower than its baseline by more than
+ *      the threshold percentage and by more than can be put down to noise
+ */
+static bool __limpet_bench_regressed(struct __limpet_test *test) {
+    const struct __limpet_bench_result *bench = &test->results->bench;
+    const struct __limpet_bench_result *base = &test->baseline->bench;
+
+    return __limpet_bench_change(test) > test->params->bench_threshold &&
+        bench->median - base->median >
+        __LIMPET_BENCH_NOISE * (bench->mad + base->mad);
+}
+
+/*
+ * Print how a benchmark compares with its baseline, for example:
+ *  median 10.1 ns/op in build 3f2a9c0d41b7, change +21.8%, regressed
+ */
+static void __limpet_print_baseline(struct __limpet_test *test) {
+    __limpet_printf("median %.4g ns/op in build %.12s, change %+.1f%%%s",
+        test->baseline->bench.median, test->baseline->build_id,
+        __limpet_bench_change(test),
+        __limpet_bench_regressed(test) ? ", regressed" : "");
+}
+#endif /* _LIMPET_BENCH_H_ */
@@ -9,60 +9,157 @@
 #define __USE_GNU                   # Get O_TMPFILE defined
 #endif
 
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/param.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <sys/wait.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <pthread.h>
 #include <pty.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
 #include <string.h>
 #include <termios.h>
 #include <unistd.h>
 
+struct __limpet_test;
+
+/*
+ * Where a test process is in its life cycle. Each test runs in its own
+ * process group, whose ID is the process ID of the test.
+ *  running - the test process is running
+ *  terminating - the test timed out and its process group has been sent
+ *      SIGTERM. It will be sent SIGKILL if it is still running at the end
+ *      of the grace period.
+ *  killed - the process group has been sent SIGKILL
+ *  draining - the test process has been reaped, but other processes in its
+ *      process group haven't gone yet
+ *  reaped - the test process has been reaped and its process group is gone
+ */
+enum __limpet_proc_state {
+    __limpet_proc_running,
+    __limpet_proc_terminating,
+    __limpet_proc_killed,
+    __limpet_proc_draining,
+    __limpet_proc_reaped,
+};
+
+/*
+ * Whether there is still output to copy from a test
+ */
+enum __limpet_io_state {
+    __limpet_io_read,
+    __limpet_io_eof,
+};
+
+/*
+ * Something the supervisor is watching with epoll
+ * test - the test the file descriptor belongs to, or NULL for the
+ *      supervisor's timerfd
+ * is_pid_fd - true if fd refers to the test process, false if it is the
+ *      file descriptor from which output is captured
+ */
+struct __limpet_watch {
+    struct __limpet_test        *test;
+    bool                        is_pid_fd;
+};
+
 /*
  * System-dependent per-test information.
- * log_fd - file descriptor for the log file.
- * raw_pty - the master side of a pseudoterminal
- * tty - the slave side of a pseudoterminal
- * thread - the thread for a test that is responsible for forking and waiting
- *      for the process whose process is in pid
+ * log_fd - file descriptor for the log file, or -1 if output isn't captured
+ * capture_fd - the side of the pseudoterminal or pipe from which the test's
+ *      output is read
+ * tty - the side of the pseudoterminal or pipe the test writes to
+ * pid_fd - file descriptor referring to the process in pid
+ * pid_watch - epoll information for pid_fd
+ * capture_watch - epoll information for capture_fd
+ * running_next - next test on the supervisor's list of running tests
+ * deadline - time, on the CLOCK_MONOTONIC clock, at which the supervisor
+ *      must next act on the test: kill it, or check whether its process
+ *      group is gone
+ * deadline_index - where the test is in the supervisor's heap of
+ *      deadlines, or __LIMPET_NO_DEADLINE if it isn't there
+ * proc_state - where the test process is in its life cycle
+ * io_state - whether there is still output to copy from capture_fd
  * timedout - true if the process timed out
  * exit_status - If we fail and have an errno value, it will be stored here.
+ * rusage - resources used by the test process, from wait4()
+ * log_bytes - number of bytes of output captured, including any that
+ *      didn't fit within the log limit
+ * stream_offset - how much of the output has been streamed to stdout
+ * perf_fds - file descriptor for each performance counter open on the
+ *      test process, or NULL if they aren't being read
  * pid - the process ID of the subprocess that actually runs the test
- * mutex - Mutex guarding the pid element of this structure
- * cond - Condition variable guarding the pid element of this structure
  */
 struct __limpet_sysdep {
     int                         log_fd;
-    int                         raw_pty;
+    int                         capture_fd;
     int                         tty;
-    pthread_t                   thread;
+    int                         pid_fd;
+    struct __limpet_watch       pid_watch;
+    struct __limpet_watch       capture_watch;
+    struct __limpet_test        *running_next;
+    struct timespec             deadline;
+    size_t                      deadline_index;
+    enum __limpet_proc_state    proc_state;
+    enum __limpet_io_state      io_state;
     bool                        timedout;
     int                         exit_status;
+    struct rusage               rusage;
+    off_t                       log_bytes;
+    off_t                       stream_offset;
+    int                         *perf_fds;
     pid_t                       pid;
 };
 
+/*
+ * Value of deadline_index for a test that can run forever, or is no longer
+ * running
+ */
+#define __LIMPET_NO_DEADLINE ((size_t)-1)
+
 #include "limpet.d/limpet-sysdep.h"
 #include "limpet.d/limpet-posix.h"
+#include "limpet.d/limpet-report.h"
+#include "limpet.d/limpet-spawn-linux.h"
+#include "limpet.d/limpet-perf-linux.h"
 
 /*
  * Value to use for __limpet_sysdep initiatization
  */
 #define __LIMPET_SYSDEP_INIT         {   \
         .log_fd = -1,                       \
-        .raw_pty = -1,                      \
-        .tty = -1,                      \
-        .thread = 0,                        \
+        .capture_fd = -1,                      \
+        .tty = -1,                          \
+        .pid_fd = -1,                       \
+        .pid_watch = { NULL, true },        \
+        .capture_watch = { NULL, false },       \
+        .running_next = NULL,               \
+        .deadline = { 0, 0 },               \
+        .deadline_index = __LIMPET_NO_DEADLINE, \
+        .proc_state = __limpet_proc_running, \
+        .io_state = __limpet_io_eof,        \
         .timedout = false,                  \
         .exit_status = 0,                   \
+        .rusage = {},                       \
+        .log_bytes = 0,                     \
+        .stream_offset = 0,                 \
+        .perf_fds = NULL,                   \
         .pid = -1,                          \
     }
 
@@ -150,14 +247,81 @@ static void __limpet_cond_wait(struct __limpet_cond *cond,
  * LIMPET_MAX_JOBS   Specifies the maximum number of threads running at a
  *      time. If this is not set or is zero, there is no limit
  * LIMPET_RUNLIST    A list of names of tests to be run, separated by
- *      colons. If this is not set or is zero length, all tests will be run. 
+ *      spaces. Entries may be fnmatch() patterns, and entries starting with
+ *      '-' exclude tests. If this is not set or is zero length, all tests
+ *      will be run.
  *      Note: If this is set to a string that has no elements that match
  *      a test name, nothing will be run.
+ * LIMPET_KILL_GRACE Seconds a test that timed out is given to exit after
+ *      SIGTERM before it is sent SIGKILL. The default is one.
+ * LIMPET_BENCH_TIME Seconds to spend running each benchmark. The default
+ *      is one.
+ * LIMPET_BENCH_HISTORY File to which benchmark results are appended, and
+ *      from which the baseline each benchmark is compared with is taken.
+ * LIMPET_BENCH_BASELINE Build ID of the results to compare with. By
+ *      default, the most recent results from another build are used.
+ * LIMPET_BENCH_THRESHOLD Percentage slowdown of a benchmark's median that
+ *      counts as a regression. The default is five.
+ * LIMPET_BENCH_GATE Benchmarks, which may be given as fnmatch() patterns,
+ *      that fail the run if they regress.
+ * LIMPET_ZYGOTE     If "true", fork tests from a small process created
+ *      when limpet starts rather than from the process running the tests.
+ * LIMPET_SPAWN      How to start tests: "fork", "clone3" or "exec". The
+ *      default is "fork". Tests are cloned from the zygote for "clone3".
+ * LIMPET_HISTORY    File in which to record how long each test took. Tests
+ *      that took longest last time are started first.
+ * LIMPET_RESOURCES  File to which the resources used by each test are
+ *      written.
+ * LIMPET_PTY        If "true", verbose output is captured through a
+ *      pseudoterminal rather than a pipe.
+ * LIMPET_STREAM     If "true", each line of output is printed as soon as the
+ *      test writes it, prefixed with the test name and time.
+ * LIMPET_LOG_LIMIT  Maximum number of bytes of output kept for each test.
+ *      Zero, the default, means there is no limit.
+ * LIMPET_LOG_DIR    Directory in which to keep logs. By default, they are
+ *      kept in memory.
+ * LIMPET_SHARD_INDEX Which of the LIMPET_SHARD_COUNT shards of the tests
+ *      to run, counting from zero.
+ * LIMPET_SHARD_COUNT Number of shards into which the tests are divided.
+ *      The default is one.
+ * LIMPET_SHARD_BY   How tests are assigned to shards: "hash" or "duration".
+ *      The default is "hash".
+ * LIMPET_LIST       If "true", list the tests as JSON instead of running
+ *      them.
+ * LIMPET_REPORT     Reports to write as tests complete, such as
+ *      "json:results.jsonl junit:results.xml".
+ * LIMPET_RLIMITS    Resource limits for each test, such as
+ *      "as=512M cpu=10 nofile=256 core=0 fsize=1G".
+ * LIMPET_PERF       If "true", read performance counters for each test.
+ * LIMPET_INPROC     If "true", run tests defined with LIMPET_TEST_INPROC in
+ *      the process running the tests.
  */
 #define __LIMPET_MAX_JOBS  "LIMPET_MAX_JOBS"
 #define __LIMPET_RUNLIST   "LIMPET_RUNLIST"
 #define __LIMPET_VERBOSE   "LIMPET_VERBOSE"
 #define __LIMPET_TIMEOUT   "LIMPET_TIMEOUT"
+#define __LIMPET_KILL_GRACE "LIMPET_KILL_GRACE"
+#define __LIMPET_BENCH_TIME "LIMPET_BENCH_TIME"
+#define __LIMPET_BENCH_HISTORY "LIMPET_BENCH_HISTORY"
+#define __LIMPET_BENCH_BASELINE "LIMPET_BENCH_BASELINE"
+#define __LIMPET_BENCH_THRESHOLD "LIMPET_BENCH_THRESHOLD"
+#define __LIMPET_BENCH_GATE "LIMPET_BENCH_GATE"
+#define __LIMPET_ZYGOTE    "LIMPET_ZYGOTE"
+#define __LIMPET_SPAWN     "LIMPET_SPAWN"
+#define __LIMPET_HISTORY   "LIMPET_HISTORY"
+#define __LIMPET_RESOURCES "LIMPET_RESOURCES"
+#define __LIMPET_PTY       "LIMPET_PTY"
+#define __LIMPET_STREAM    "LIMPET_STREAM"
+#define __LIMPET_LOG_LIMIT "LIMPET_LOG_LIMIT"
+#define __LIMPET_LOG_DIR   "LIMPET_LOG_DIR"
+#define __LIMPET_SHARD_INDEX "LIMPET_SHARD_INDEX"
+#define __LIMPET_SHARD_COUNT "LIMPET_SHARD_COUNT"
+#define __LIMPET_SHARD_BY  "LIMPET_SHARD_BY"
+#define __LIMPET_LIST      "LIMPET_LIST"
+#define __LIMPET_REPORT    "LIMPET_REPORT"
+#define __LIMPET_RLIMITS   "LIMPET_RLIMITS"
+#define __LIMPET_PERF      "LIMPET_PERF"
+#define __LIMPET_INPROC    "LIMPET_INPROC"
 
 /*
  * List of all environment variables to eliminate before running the test
@@ -166,8 +330,54 @@ static const char *__limpet_envvars[] = {
     __LIMPET_MAX_JOBS,
     __LIMPET_RUNLIST,
     __LIMPET_TIMEOUT,
+    __LIMPET_KILL_GRACE,
+    __LIMPET_BENCH_TIME,
+    __LIMPET_BENCH_HISTORY,
+    __LIMPET_BENCH_BASELINE,
+    __LIMPET_BENCH_THRESHOLD,
+    __LIMPET_BENCH_GATE,
+    __LIMPET_ZYGOTE,
+    __LIMPET_SPAWN,
+    __LIMPET_HISTORY,
+    __LIMPET_RESOURCES,
+    __LIMPET_PTY,
+    __LIMPET_STREAM,
+    __LIMPET_LOG_LIMIT,
+    __LIMPET_LOG_DIR,
+    __LIMPET_SHARD_INDEX,
+    __LIMPET_SHARD_COUNT,
+    __LIMPET_SHARD_BY,
+    __LIMPET_LIST,
+    __LIMPET_REPORT,
+    __LIMPET_RLIMITS,
+    __LIMPET_PERF,
+    __LIMPET_INPROC,
 };
 
+/*
+ * Parameters only used by the Linux version
+ * zygote - true if tests are forked from the zygote process
+ * spawn - how tests are started when not using the zygote
+ * pty - true if verbose output is captured with a pseudoterminal, false if
+ *      it is captured with a pipe
+ * stream - true if output lines are printed as they are captured
+ * log_limit - maximum number of bytes of output kept for each test, or
+ *      zero for no limit. The first half is kept as is, the rest holds the
+ *      most recent output.
+ * log_dir - directory in which to create logs, or NULL to keep them in
+ *      memory
+ */
+struct __limpet_linux_params {
+    bool                            zygote;
+    enum __limpet_spawn_strategy    spawn;
+    bool                            pty;
+    bool                            stream;
+    off_t                           log_limit;
+    const char                      *log_dir;
+};
+
+struct __limpet_linux_params __limpet_linux_params __attribute((common));
+
 static const char *__limpet_get_maxjobs(void) {
     return getenv(__LIMPET_MAX_JOBS);
 }
@@ -183,10 +393,180 @@ static const char *__limpet_get_timeout(void) {
     return getenv(__LIMPET_TIMEOUT);
 }
 
+static const char *__limpet_get_kill_grace(void) {
+    return getenv(__LIMPET_KILL_GRACE);
+}
+
+static const char *__limpet_get_bench_time(void) {
+    return getenv(__LIMPET_BENCH_TIME);
+}
+
+static const char *__limpet_get_bench_history(void) {
+    return getenv(__LIMPET_BENCH_HISTORY);
+}
+
+static const char *__limpet_get_bench_baseline(void) {
+    return getenv(__LIMPET_BENCH_BASELINE);
+}
+
+static const char *__limpet_get_bench_threshold(void) {
+    return getenv(__LIMPET_BENCH_THRESHOLD);
+}
+
+static const char *__limpet_get_bench_gate(void) {
+    return getenv(__LIMPET_BENCH_GATE);
+}
+
 static const char *__limpet_get_verbose(void) {
     return getenv(__LIMPET_VERBOSE);
 }
 
+static const char *__limpet_get_history(void) {
+    return getenv(__LIMPET_HISTORY);
+}
+
+static const char *__limpet_get_resources(void) {
+    return getenv(__LIMPET_RESOURCES);
+}
+
+static const char *__limpet_get_shard_index(void) {
+    return getenv(__LIMPET_SHARD_INDEX);
+}
+
+static const char *__limpet_get_shard_count(void) {
+    return getenv(__LIMPET_SHARD_COUNT);
+}
+
+static const char *__limpet_get_shard_by(void) {
+    return getenv(__LIMPET_SHARD_BY);
+}
+
+static const char *__limpet_get_list(void) {
+    return getenv(__LIMPET_LIST);
+}
+
+static const char *__limpet_get_report(void) {
+    return getenv(__LIMPET_REPORT);
+}
+
+static const char *__limpet_get_rlimits(void) {
+    return getenv(__LIMPET_RLIMITS);
+}
+
+static const char *__limpet_get_perf(void) {
+    return getenv(__LIMPET_PERF);
+}
+
+static const char *__limpet_get_inproc(void) {
+    return getenv(__LIMPET_INPROC);
+}
+
+/*
+ * Convert a number of bytes, which may be followed by K, M or G for
+ * kibibytes, mebibytes or gibibytes
+ * name - name of the configuration variable, for error messages
+ * value - the value, or NULL to get zero
+ */
+static off_t __limpet_parse_size(const char *name, const char *value) {
+    unsigned long long size;
+    unsigned shift;
+    char *endptr;
+
+    if (value == NULL || *value == '\0') {
+        return 0;
+    }
+
+    /*
+     * strtoull() would take a leading '-' and negate the result
+     */
+    errno = 0;
+    size = strtoull(value, &endptr, 0);
+    if (errno != 0 || endptr == value ||
+        value[strspn(value, " \t")] == '-') {
+        __limpet_fail("%s must be a number of bytes\n", name);
+    }
+
+    switch (*endptr) {
+    case 'G':
+    case 'g':
+        shift = 30;
+        endptr++;
+        break;
+
+    case 'M':
+    case 'm':
+        shift = 20;
+        endptr++;
+        break;
+
+    case 'K':
+    case 'k':
+        shift = 10;
+        endptr++;
+        break;
+
+    default:
+        shift = 0;
+        break;
+    }
+
+    if (*endptr != '\0') {
+        __limpet_fail("%s must be a number of bytes\n", name);
+    }
+
+    if (size > (unsigned long long)LLONG_MAX >> shift) {
+        __limpet_fail("%s is too large\n", name);
+    }
+
+    return (off_t)(size << shift);
+}
+
+/*
+ * Tests forked from the zygote inherit fixtures too, since fixtures are
+ * set up before the zygote is started
+ */
+static bool __limpet_fixtures_inherited(void) {
+    return __limpet_linux_params.zygote ||
+        __limpet_linux_params.spawn != __limpet_spawn_exec;
+}
+
+static void __limpet_parse_sysdep_params(void) {
+    __limpet_linux_params.zygote = __limpet_parse_bool("ZYGOTE",
+        getenv(__LIMPET_ZYGOTE), false);
+    __limpet_linux_params.spawn = __limpet_parse_spawn(getenv(__LIMPET_SPAWN));
+
+    /*
+     * The supervisor thread uses stdio and malloc, so a test cloned from
+     * this process without going through glibc could start with one of
+     * their locks held. The zygote is forked while we are still single
+     * threaded and already starts each test with clone3(), so it does the
+     * cloning instead.
+     */
+    if (__limpet_linux_params.spawn == __limpet_spawn_clone3) {
+        __limpet_linux_params.zygote = true;
+    }
+
+    __limpet_linux_params.pty = __limpet_parse_bool("PTY",
+        getenv(__LIMPET_PTY), false);
+    __limpet_linux_params.stream = __limpet_parse_bool("STREAM",
+        getenv(__LIMPET_STREAM), false);
+    __limpet_linux_params.log_limit =
+        __limpet_parse_size("LOG_LIMIT", getenv(__LIMPET_LOG_LIMIT));
+    __limpet_linux_params.log_dir = getenv(__LIMPET_LOG_DIR);
+    if (__limpet_linux_params.log_dir != NULL &&
+        *__limpet_linux_params.log_dir == '\0') {
+        __limpet_linux_params.log_dir = NULL;
+    }
+}
+
+/*
+ * Returns: true if the output of tests is captured, either to be printed
+ *      when the test completes or to be streamed
+ */
+static bool __limpet_capture_output(void) {
+    return __limpet_params.verbose || __limpet_linux_params.stream;
+}
+
 /*
  * Remove things in the environment specific to leavmein
  */
@@ -205,10 +585,16 @@ static void __limpet_parse_done(void)
     }
 }
 
+/*
+ * Size to which we try to grow the pipe used to capture output, so that a
+ * test writing a lot of output doesn't have to wait for us as often
+ */
+#define __LIMPET_PIPE_SIZE  (256 * 1024)
+
 /*
  * Create a file descriptor so that the test can play with stdin, stdout,
- * and stderr. This will normally be a pseudoterminal but will be /dev/null
- * when verbose is true
+ * and stderr. When output is captured, this is a pipe, or a pseudoterminal
+ * if the test needs a terminal. Otherwise, it is /dev/null.
  */
 static void __limpet_make_std_fd(struct __limpet_sysdep *sysdep)
     __LIMPET_UNUSED;
@@ -217,7 +603,33 @@ static void __limpet_make_std_fd(struct __limpet_sysdep *sysdep) {
     struct winsize winsize;
     int rc;
 
-    if (__limpet_params.verbose) {
+    if (__limpet_capture_output() && !__limpet_linux_params.pty) {
+        int fds[2];
+
+        /*
+         * pipe2() isn't declared if <unistd.h> was included before us
+         */
+        if (pipe(fds) == -1) {
+            __limpet_fail_errno("Unable to create pipe");
+        }
+
+        if (fcntl(fds[0], F_SETFD, FD_CLOEXEC) == -1 ||
+            fcntl(fds[1], F_SETFD, FD_CLOEXEC) == -1) {
+            __limpet_fail_errno("Unable to set FD_CLOEXEC on pipe");
+        }
+
+        if (fcntl(fds[0], F_SETFL, O_NONBLOCK) == -1) {
+            __limpet_fail_errno("Unable to set O_NONBLOCK on pipe");
+        }
+
+        /*
+         * A larger pipe is nice to have, but we can live without it
+         */
+        (void)fcntl(fds[1], F_SETPIPE_SZ, __LIMPET_PIPE_SIZE);
+
+        sysdep->capture_fd = fds[0];
+        sysdep->tty = fds[1];
+    } else if (__limpet_capture_output()) {
         rc = tcgetattr(0, &termios);
         if (rc == -1) {
             __limpet_fail_errno("Unable to get terminal characteristics");
@@ -228,11 +640,19 @@ static void __limpet_make_std_fd(struct __limpet_sysdep *sysdep) {
             __limpet_fail_errno("Unable to get windows size");
         }
 
-        rc = openpty(&sysdep->raw_pty, &sysdep->tty, NULL, &termios,
+        rc = openpty(&sysdep->capture_fd, &sysdep->tty, NULL, &termios,
             &winsize);
         if (rc == -1) {
             __limpet_fail_errno("Unable to create pty");
         }
+
+        if (fcntl(sysdep->capture_fd, F_SETFD, FD_CLOEXEC) == -1) {
+            __limpet_fail_errno("Unable to set FD_CLOEXEC on pty");
+        }
+
+        if (fcntl(sysdep->capture_fd, F_SETFL, O_NONBLOCK) == -1) {
+            __limpet_fail_errno("Unable to set O_NONBLOCK on pty");
+        }
     } else {
         sysdep->tty = open("/dev/null", O_RDWR);
         if (sysdep->tty == -1) {
@@ -241,27 +661,60 @@ static void __limpet_make_std_fd(struct __limpet_sysdep *sysdep) {
     }
 }
 
-static bool __limpet_thread_setup(struct __limpet_test *test) {
-    static const char tmpfile_name_template[] = "/tmp/logfileXXXXXX";
-    char tmpfile_name[sizeof(tmpfile_name_template)];
+/*
+ * Create the log for a test. Unless we were given a directory for logs, it
+ * is kept in memory.
+ */
+static void __limpet_make_log(struct __limpet_test *test) {
+    const char *dir;
+    char *name;
+    size_t name_size;
+
+    dir = __limpet_linux_params.log_dir;
+    if (dir == NULL) {
+        test->sysdep.log_fd = memfd_create(test->name, MFD_CLOEXEC);
+        if (test->sysdep.log_fd == -1) {
+            __limpet_fail_errno("Unable to make log for %s", test->name);
+        }
+        return;
+    }
+
+    test->sysdep.log_fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC,
+        S_IRUSR | S_IWUSR);
 
-    test->sysdep.log_fd = open(tmpfile_name_template,
-        O_TMPFILE | O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (test->sysdep.log_fd == -1 && (errno == EINVAL ||
+        errno == EOPNOTSUPP || errno == EISDIR)) {
+        name_size = strlen(dir) + sizeof("/logfileXXXXXX");
+        name = (char *)malloc(name_size);
+        if (name == NULL) {
+            __limpet_fail("Out of memory allocating %zu bytes\n", name_size);
+        }
 
-    if (test->sysdep.log_fd == -1 && errno == EINVAL) {
-        strncpy(tmpfile_name, tmpfile_name_template, sizeof(tmpfile_name));
-        test->sysdep.log_fd = mkstemp(tmpfile_name);
+        snprintf(name, name_size, "%s/logfileXXXXXX", dir);
+        test->sysdep.log_fd = mkstemp(name);
+        if (test->sysdep.log_fd != -1) {
+            unlink(name);
+            (void)fcntl(test->sysdep.log_fd, F_SETFD, FD_CLOEXEC);
+        }
+        free(name);
     }
 
     if (test->sysdep.log_fd == -1) {
-        __limpet_fail_errno("Unable to make log file");
+        __limpet_fail_errno("Unable to make log file in %s", dir);
     }
+}
 
+static bool __limpet_test_setup(struct __limpet_test *test) {
+    if (__limpet_capture_output()) {
+        __limpet_make_log(test);
+    }
     __limpet_make_std_fd(&test->sysdep);
 
     return true;
 }
 
+static void __limpet_setup_tty(int tty);
+
 /*
  * Running in the context of a test child process, set up a new test
  * process. 
@@ -273,26 +726,35 @@ static void __limpet_setup_std_fds(struct __limpet_sysdep *sysdep) {
      * We no longer need to do anything with the log file or raw
      * raw pseudoterminal file descriptors
      */
-    if (close(sysdep->log_fd) == -1) {
-        __limpet_fail_errno("close(log_fd %d)", sysdep->log_fd);
-    }
+    if (__limpet_capture_output()) {
+        if (close(sysdep->log_fd) == -1) {
+            __limpet_fail_errno("close(log_fd %d)", sysdep->log_fd);
+        }
 
-    if (__limpet_params.verbose) {
-        if (close(sysdep->raw_pty) == -1) {
-            __limpet_fail_errno("close(child raw_pty %d)", sysdep->raw_pty);
+        if (close(sysdep->capture_fd) == -1) {
+            __limpet_fail_errno("close(child capture_fd %d)",
+                sysdep->capture_fd);
         }
     }
 
-    if (dup2(sysdep->tty, 0) == -1) {
-        __limpet_fail_errno("dup2(%d, %d)", sysdep->tty, 0);
+    __limpet_setup_tty(sysdep->tty);
+}
+
+/*
+ * Running in the context of a test child process, make the given tty the
+ * standard input, output and error
+ */
+static void __limpet_setup_tty(int tty) {
+    if (dup2(tty, 0) == -1) {
+        __limpet_fail_errno("dup2(%d, %d)", tty, 0);
     }
 
     /* Now we don't need the original pesudoterminal file descriptor, either
      *
      */
 
-    if (close(sysdep->tty) == -1) {
-        __limpet_fail_errno("close(tty %d)", sysdep->tty);
+    if (close(tty) == -1) {
+        __limpet_fail_errno("close(tty %d)", tty);
     }
 
     /*
@@ -307,312 +769,944 @@ static void __limpet_setup_std_fds(struct __limpet_sysdep *sysdep) {
 }
 
 /*
- * Copy output into the log and wait for the process to terminate
+ * The zygote is a process forked before the process running the tests has
+ * grown, so that forking a test from it stays cheap. Tests are forked with
+ * CLONE_PARENT so that they are children of the process running the tests,
+ * just as though it had forked them itself.
+ * pid - process ID of the zygote
+ * sock - our end of the socket used to send requests to the zygote, or
+ *      -1 if there is no zygote
  */
-static void __limpet_log_and_wait(struct __limpet_test *test) {
-    enum { io_read, io_write, io_eof } io_state;
-    enum { proc_running, proc_killed, proc_reaped } proc_state;
-    struct timeval timeout;
-    struct timeval abs_timeout;
-    fd_set rfds;
-    fd_set wfds;
-    char buf[4096];
-    int nfds;
-    int pid_fd;
-    int rc;
+struct __limpet_zygote {
+    pid_t   pid;
+    int     sock;
+};
 
-    timeout.tv_sec = (time_t)test->params->timeout;
-    timeout.tv_usec = (suseconds_t)((test->params->timeout - timeout.tv_sec) *
-        1000000);
-    rc = gettimeofday(&abs_timeout, NULL);
-    if (rc == -1) {
-        __limpet_fail_errno("gettimeofday failed");
-    }
-    timeradd(&abs_timeout, &timeout, &abs_timeout);
+struct __limpet_zygote __limpet_zygote __attribute((common));
 
-    /*
-     * Get a file descriptor for this pid so we can use select() to wait for
-     * it to exit
-     */
-    pid_fd = syscall(SYS_pidfd_open, test->sysdep.pid, 0);
-    if (pid_fd == -1) {
-        __limpet_fail_errno("pidfd_open failed for pid %d",
-            test->sysdep.pid);
+/*
+ * Request sent to the zygote to start a test. The tty to use for
+ * the test's standard input, output and error is passed along with it.
+ */
+struct __limpet_zygote_request {
+    struct __limpet_test    *test;
+};
+
+/*
+ * Send a message and, optionally, a file descriptor over a socket
+ */
+static void __limpet_send_msg(int sock, const void *buf, size_t size,
+    int fd) {
+    union {
+        char            buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr  align;
+    } control;
+    struct msghdr msg;
+    struct iovec iov;
+    ssize_t zrc;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = (void *)buf;
+    iov.iov_len = size;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (fd != -1) {
+        struct cmsghdr *cmsg;
+
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
     }
 
-    /*
-     * If we are in non-verbose mode, we have nothing to read and are
-     * effectively at the EOF
-     */
-    if (__limpet_params.verbose) {
-        io_state = io_read;
-    } else {
-        io_state = io_eof;
+    zrc = sendmsg(sock, &msg, 0);
+    if (zrc == -1) {
+        __limpet_fail_errno("sendmsg failed");
     }
+}
 
-    proc_state = proc_running;
+/*
+ * Receive a message and any file descriptor sent with it
+ *
+ * Returns: the number of bytes received, which is zero at end of file
+ */
+static ssize_t __limpet_recv_msg(int sock, void *buf, size_t size,
+    int *fd) {
+    union {
+        char            buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr  align;
+    } control;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    ssize_t zrc;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = buf;
+    iov.iov_len = size;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
 
     do {
-        struct timeval delta_timeout;
-        struct timeval now;
-        struct timeval *tv;
-        ssize_t zrc;
-
-        nfds = 0;
-
-        FD_ZERO(&rfds);
-        FD_ZERO(&wfds);
-
-        switch (proc_state) {
-        case proc_running:
-            FD_SET(pid_fd, &rfds);
-            nfds = MAX(nfds, pid_fd + 1);
+        zrc = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (zrc == -1 && errno == EINTR);
 
-            rc = gettimeofday(&now, NULL);
-            if (rc == -1) {
-                __limpet_fail("gettimeofday failed");
-            }
-            if (timercmp(&abs_timeout, &now, >)) {
-                timersub(&abs_timeout, &now, &delta_timeout);
-            } else {
-                timerclear(&delta_timeout);
-            }
-            tv = &delta_timeout;
-            break;
-
-        case proc_killed:
-            FD_SET(pid_fd, &rfds);
-            nfds = MAX(nfds, pid_fd + 1);
-            tv = NULL;
-            break;
+    if (zrc == -1) {
+        __limpet_fail_errno("recvmsg failed");
+    }
 
-        case proc_reaped:
-            tv = NULL;
-            break;
+    if (fd != NULL) {
+        *fd = -1;
+        cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(fd, CMSG_DATA(cmsg), sizeof(*fd));
         }
+    }
 
-        if (__limpet_params.verbose) {
-            switch (io_state) {
-            case io_read:
-                FD_SET(test->sysdep.raw_pty, &rfds);
-                nfds = MAX(nfds, test->sysdep.raw_pty + 1);
-                break;
+    return zrc;
+}
 
-            case io_write:
-                FD_SET(test->sysdep.log_fd, &wfds);
-                nfds = MAX(nfds, test->sysdep.log_fd + 1);
-                break;
+/*
+ * The main loop of the zygote. Start a test for each request and reply
+ * with the process ID of the test, along with a pidfd for it if we were
+ * able to get one. Exits when the other end of the socket is closed.
+ */
+static void __limpet_zygote_loop(int sock) __attribute((noreturn));
+static void __limpet_zygote_loop(int sock) {
+    for (;;) {
+        struct __limpet_zygote_request request;
+        ssize_t zrc;
+        pid_t pid;
+        int pid_fd;
+        int tty;
 
-            case io_eof:
-                break;
-            }
+        zrc = __limpet_recv_msg(sock, &request, sizeof(request), &tty);
+        if (zrc == 0) {
+            _exit(EXIT_SUCCESS);
         }
 
-        rc = select(nfds, &rfds, &wfds, NULL, tv);
-        if (rc == -1) {
-            __limpet_fail_errno("Select failed");
+        if (zrc != sizeof(request) || tty == -1) {
+            __limpet_fail("Bad request received by zygote\n");
         }
 
-        switch (proc_state) {
-        case proc_running:
-            if (FD_ISSET(pid_fd, &rfds)) {
-                rc = waitpid(test->sysdep.pid, &test->sysdep.exit_status, 0);
-                if (rc == -1) {
-                    __limpet_fail_errno("waitpid failed");
-                }
-                proc_state = proc_reaped;
-            } else if (rc == 0) {
-                test->sysdep.timedout = true;
-                rc = kill(test->sysdep.pid, SIGKILL);
-                if (rc == -1) {
-                    __limpet_warn("Unable to kill PID %d\n",
-                        test->sysdep.pid);
-                }
-                proc_state = proc_killed;
-            }
+        /*
+         * This is fork(), except that the test becomes a sibling of the
+         * zygote
+         */
+        pid = __limpet_clone(CLONE_PARENT, &pid_fd);
+        switch (pid) {
+        case -1:
+            __limpet_fail_errno("clone failed");
             break;
 
-        case proc_killed:
-            if (FD_ISSET(pid_fd, &rfds)) {
-                rc = waitpid(test->sysdep.pid, &test->sysdep.exit_status, 0);
-                if (rc == -1) {
-                    __limpet_fail_errno("waitpid failed");
-                }
-                proc_state = proc_reaped;
+        case 0:
+            if (close(sock) == -1) {
+                __limpet_fail_errno("close(zygote sock %d)", sock);
             }
+            __limpet_new_process_group();
+            __limpet_setup_tty(tty);
+            __limpet_call_test(request.test);
+            __limpet_exit(false);
             break;
 
-        case proc_reaped:
+        default:
+            if (close(tty) == -1) {
+                __limpet_fail_errno("close(tty %d)", tty);
+            }
+            __limpet_send_msg(sock, &pid, sizeof(pid), pid_fd);
+            if (pid_fd != -1 && close(pid_fd) == -1) {
+                __limpet_fail_errno("close(pid_fd %d)", pid_fd);
+            }
             break;
         }
-            
-        if (__limpet_params.verbose) {
-            switch (io_state) {
-            case io_read:
-                if (FD_ISSET(test->sysdep.raw_pty, &rfds)) {
-                    zrc = read(test->sysdep.raw_pty, buf, sizeof(buf));
-                    switch (zrc) {
-                    case -1:
-                        /*
-                         * I would have expected a zero return when the
-                         * other end of the pseudoterminal was closed, but
-                         * seem to get this
-                         */
-                        if (errno != EIO) {
-                            __limpet_fail_errno("raw pty read failed");
-                        }
-                        io_state = io_eof;
-                        break;
-
-                    case 0:
-                        io_state = io_eof;
-                        break;
-
-                    default:
-                        io_state = io_write;
-                        break;
-                    }
-                }
-                break;
-
-            case io_write:
-                if (FD_ISSET(test->sysdep.log_fd, &wfds)) {
-                    zrc = write(test->sysdep.log_fd, buf, zrc);
-                    if (zrc == -1) {
-                        __limpet_fail_errno("log write failed");
-                    }
-                }
+    }
+}
 
-                io_state = io_read;
-                break;
+/*
+ * Fork the zygote. This must be done while we are still single threaded.
+ */
+static void __limpet_start_zygote(void) {
+    int socks[2];
 
-            case io_eof:
-                break;
-            }
-        }
-    } while (proc_state != proc_reaped || io_state != io_eof);
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0,
+        socks) == -1) {
+        __limpet_fail_errno("socketpair failed");
+    }
 
-    if (close(pid_fd) == -1) {
-        __limpet_fail_errno("close(pid_fd) failed");
+    if (fflush(stdout) == -1) {
+        __limpet_fail_errno("fflush(stdout) failed");
     }
 
-    if (__limpet_params.verbose) {
-        if (close(test->sysdep.raw_pty) == -1) {
-            __limpet_fail_errno("close(parent raw_pty) failed");
+    __limpet_zygote.pid = fork();
+    switch (__limpet_zygote.pid) {
+    case -1:
+        __limpet_fail_errno("Fork of zygote failed");
+        break;
+
+    case 0:
+        if (close(socks[0]) == -1) {
+            __limpet_fail_errno("close(socks[0]) failed");
+        }
+        __limpet_zygote_loop(socks[1]);
+        break;
+
+    default:
+        if (close(socks[1]) == -1) {
+            __limpet_fail_errno("close(socks[1]) failed");
         }
+        __limpet_zygote.sock = socks[0];
+        break;
     }
 }
 
 /*
- * This dumps the log file to standard out. We're going to have to convert
- * carriage return/linefeed sequences to newlines.
+ * Ask the zygote to start a test
+ * test - the test to start
+ * pid_fd - set to a pidfd for the test, or -1 if the zygote couldn't get
+ *      one
  *
- * Returns true if there was something to print, false otherwise
+ * Returns: the process ID of the test
  */
-static ssize_t __limpet_dump_stored_log(struct __limpet_test *test) {
-    char buf[4096];
-    ssize_t zrc = 0;
-    ssize_t total = 0;
-    bool last_was_cr;
+static pid_t __limpet_zygote_fork(struct __limpet_test *test, int *pid_fd) {
+    struct __limpet_zygote_request request;
+    pid_t pid;
+    ssize_t zrc;
 
-    if (!__limpet_params.verbose) {
-        return 1;
-    }
+    request.test = test;
+    __limpet_send_msg(__limpet_zygote.sock, &request, sizeof(request),
+        test->sysdep.tty);
 
-    if (lseek(test->sysdep.log_fd, 0, SEEK_SET) == (off_t) -1) {
-        __limpet_fail_errno("lseek failed on fd %d", test->sysdep.log_fd);
+    zrc = __limpet_recv_msg(__limpet_zygote.sock, &pid, sizeof(pid), pid_fd);
+    if (zrc != sizeof(pid)) {
+        __limpet_fail("Zygote failed to start test %s\n", test->name);
     }
 
-    last_was_cr = false;
-
-    for (zrc = read(test->sysdep.log_fd, buf, sizeof(buf)); zrc > 0;
-        zrc = read(test->sysdep.log_fd, buf, sizeof(buf))) {
-        size_t i;
+    return pid;
+}
 
-        /*
-         * Convert carriage return-linefeed to a simple linefeed
-         */
-        for (i = 0; i < (size_t)zrc; i++) {
-            char c;
+/*
+ * State shared between the thread starting tests and the supervisor
+ * thread, which waits for all running tests.
+ * epoll_fd - file descriptor for the epoll set holding the pidfd and
+ *      capture file descriptor of every running test, and timer_fd
+ * timer_fd - timerfd on the CLOCK_MONOTONIC clock, set to expire at the
+ *      earliest deadline of any running test
+ * timer_watch - epoll information for timer_fd
+ * thread - the supervisor thread
+ * mutex - guards running, starting, deadlines and the setting of timer_fd
+ * output_mutex - held while streamed output or a test's report is
+ *      written to stdout, so the two don't get mixed together
+ * running - list of tests that have been started but not yet completed
+ * starting - number of tests being started that aren't on running yet
+ * deadlines - binary min-heap of the running tests with deadlines, so the
+ *      earliest deadline is always deadlines[0]
+ * n_deadlines - number of tests in deadlines
+ * deadlines_size - number of elements allocated for deadlines
+ */
+struct __limpet_supervisor {
+    int                     epoll_fd;
+    int                     timer_fd;
+    struct __limpet_watch   timer_watch;
+    pthread_t               thread;
+    struct __limpet_mutex   mutex;
+    struct __limpet_mutex   output_mutex;
+    struct __limpet_test    *running;
+    unsigned                starting;
+    struct __limpet_test    **deadlines;
+    size_t                  n_deadlines;
+    size_t                  deadlines_size;
+};
 
-            c = buf[i];
+struct __limpet_supervisor __limpet_supervisor __attribute((common));
 
-            switch (c) {
-            case '\n':
-                if (last_was_cr) {
-                    putchar('\n');
-                    last_was_cr = false;
-                }
-                break;
+/*
+ * Maximum number of epoll events to handle per wakeup
+ */
+#define __LIMPET_MAX_EVENTS 64
 
-            case '\r':
-                if (last_was_cr) {
-                    putchar('\r');
-                } else {
-                    last_was_cr = true;
-                }
-                break;
+/*
+ * Add a file descriptor to the supervisor's epoll set
+ */
+static void __limpet_watch_fd(int fd, struct __limpet_watch *watch) {
+    struct epoll_event event;
 
-            default:
-                putchar(c);
-                last_was_cr = false;
-                break;
-            }
-        }
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = watch;
 
-        total += zrc;
+    if (epoll_ctl(__limpet_supervisor.epoll_fd, EPOLL_CTL_ADD, fd,
+        &event) == -1) {
+        __limpet_fail_errno("epoll_ctl(EPOLL_CTL_ADD, %d) failed", fd);
     }
+}
 
-    if (zrc != 0) {
-        return -1;
+/*
+ * Remove a file descriptor from the supervisor's epoll set and close it
+ */
+static void __limpet_unwatch_fd(int fd) {
+    if (epoll_ctl(__limpet_supervisor.epoll_fd, EPOLL_CTL_DEL, fd,
+        NULL) == -1) {
+        __limpet_fail_errno("epoll_ctl(EPOLL_CTL_DEL, %d) failed", fd);
     }
 
-    if (close(test->sysdep.log_fd) != 0) {
-        __limpet_warn_errno("Close of log file failed");
+    if (close(fd) == -1) {
+        __limpet_fail_errno("close(%d) failed", fd);
     }
-
-    return total;
 }
 
 /*
- * Run the test as a subprocess
+ * Swap two elements of the heap of deadlines. Called with the supervisor
+ * mutex held, as are the other functions handling deadlines.
  */
-static void *__limpet_run_one(void *arg) __LIMPET_UNUSED;
-static void *__limpet_run_one(void *arg) {
-    struct __limpet_test *test = (struct __limpet_test *)arg;
-    pid_t pid;
-
-    __limpet_thread_setup(test);
+static void __limpet_swap_deadlines(size_t i, size_t j) {
+    struct __limpet_test **deadlines = __limpet_supervisor.deadlines;
+    struct __limpet_test *tmp;
+
+    tmp = deadlines[i];
+    deadlines[i] = deadlines[j];
+    deadlines[j] = tmp;
+    deadlines[i]->sysdep.deadline_index = i;
+    deadlines[j]->sysdep.deadline_index = j;
+}
 
-    if (fflush(stdout) == -1) {
-        __limpet_fail_errno("fflush(stdout) failed");
+/*
+ * Restore the heap property for element i, moving it up or down
+ */
+static void __limpet_fix_deadline(size_t i) {
+    struct __limpet_test **deadlines = __limpet_supervisor.deadlines;
+    size_t n = __limpet_supervisor.n_deadlines;
+
+    while (i != 0 && __limpet_timespec_before(&deadlines[i]->sysdep.deadline,
+        &deadlines[(i - 1) / 2]->sysdep.deadline)) {
+        __limpet_swap_deadlines(i, (i - 1) / 2);
+        i = (i - 1) / 2;
     }
 
-    pid = fork();
-    switch (pid) {
-    case -1:
-        __limpet_fail_errno("Fork failed");
-        break;
+    for (;;) {
+        size_t earliest = i;
+        size_t child;
 
-    case 0:
-        __limpet_setup_std_fds(&test->sysdep);
-        (*test->func)();
-        __limpet_exit(false);
-        break;
+        for (child = 2 * i + 1; child <= 2 * i + 2 && child < n; child++) {
+            if (__limpet_timespec_before(&deadlines[child]->sysdep.deadline,
+                &deadlines[earliest]->sysdep.deadline)) {
+                earliest = child;
+            }
+        }
 
-    default:
-        /*
-         * Set the process ID and let the wait begin
-         */
-        if (close(test->sysdep.tty) == -1) {
-            __limpet_fail_errno("close(test->tty) failed");
+        if (earliest == i) {
+            break;
         }
-        test->sysdep.tty = -1;
-        test->sysdep.pid = pid;
+
+        __limpet_swap_deadlines(i, earliest);
+        i = earliest;
+    }
+}
+
+/*
+ * Set timer_fd to expire at the earliest deadline, or disarm it if no
+ * running test has a deadline
+ */
+static void __limpet_set_timer(void) {
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    if (__limpet_supervisor.n_deadlines != 0) {
+        its.it_value = __limpet_supervisor.deadlines[0]->sysdep.deadline;
+    }
+
+    if (timerfd_settime(__limpet_supervisor.timer_fd, TFD_TIMER_ABSTIME,
+        &its, NULL) == -1) {
+        __limpet_fail_errno("timerfd_settime failed");
+    }
+}
+
+static void __limpet_add_deadline(struct __limpet_test *test) {
+    size_t i;
+
+    if (__limpet_supervisor.n_deadlines == __limpet_supervisor.deadlines_size) {
+        size_t size;
+
+        size = __limpet_supervisor.deadlines_size == 0 ? 64 :
+            2 * __limpet_supervisor.deadlines_size;
+        __limpet_supervisor.deadlines = (struct __limpet_test **)realloc(
+            __limpet_supervisor.deadlines,
+            sizeof(__limpet_supervisor.deadlines[0]) * size);
+        if (__limpet_supervisor.deadlines == NULL) {
+            __limpet_fail("Out of memory allocating %zu deadlines\n", size);
+        }
+        __limpet_supervisor.deadlines_size = size;
+    }
+
+    i = __limpet_supervisor.n_deadlines++;
+    __limpet_supervisor.deadlines[i] = test;
+    test->sysdep.deadline_index = i;
+    __limpet_fix_deadline(i);
+
+    if (test->sysdep.deadline_index == 0) {
+        __limpet_set_timer();
+    }
+}
+
+static void __limpet_remove_deadline(struct __limpet_test *test) {
+    size_t i;
+    size_t last;
+
+    i = test->sysdep.deadline_index;
+    if (i == __LIMPET_NO_DEADLINE) {
+        return;
+    }
+
+    last = --__limpet_supervisor.n_deadlines;
+    if (i != last) {
+        __limpet_swap_deadlines(i, last);
+        __limpet_fix_deadline(i);
+    }
+    test->sysdep.deadline_index = __LIMPET_NO_DEADLINE;
+
+    if (i == 0) {
+        __limpet_set_timer();
+    }
+}
+
+/*
+ * Interval at which the supervisor checks whether what is left of a test's
+ * process group is gone
+ */
+#define __LIMPET_DRAIN_INTERVAL 0.001
+
+/*
+ * Set a new deadline for a test that is no longer in the heap
+ */
+static void __limpet_set_deadline(struct __limpet_test *test,
+    double seconds) {
+    __limpet_mutex_lock(&__limpet_supervisor.mutex);
+    __limpet_deadline(seconds, &test->sysdep.deadline);
+    __limpet_add_deadline(test);
+    __limpet_mutex_unlock(&__limpet_supervisor.mutex);
+}
+
+static void __limpet_check_complete(struct __limpet_test *test);
+
+/*
+ * Kill whatever is left of the test's process group once the test process
+ * has been reaped. If anything is left, check again shortly.
+ */
+static void __limpet_drain_group(struct __limpet_test *test) {
+    if (__limpet_kill_group(test->sysdep.pid)) {
+        test->sysdep.proc_state = __limpet_proc_reaped;
+        __limpet_check_complete(test);
+    } else {
+        test->sysdep.proc_state = __limpet_proc_draining;
+        __limpet_set_deadline(test, __LIMPET_DRAIN_INTERVAL);
+    }
+}
+
+/*
+ * Act on a test whose deadline has passed. A test that has run too long is
+ * sent SIGTERM, along with its process group, then SIGKILL if it hasn't
+ * exited by the end of the grace period.
+ */
+static void __limpet_expire(struct __limpet_test *test) {
+    switch (test->sysdep.proc_state) {
+    case __limpet_proc_running:
+        test->sysdep.timedout = true;
+        if (test->params->kill_grace != 0) {
+            __limpet_signal_group(test->sysdep.pid, SIGTERM);
+            test->sysdep.proc_state = __limpet_proc_terminating;
+            __limpet_set_deadline(test, test->params->kill_grace);
+            break;
+        }
+        /* fall through */
+
+    case __limpet_proc_terminating:
+        __limpet_signal_group(test->sysdep.pid, SIGKILL);
+        test->sysdep.proc_state = __limpet_proc_killed;
         break;
+
+    case __limpet_proc_draining:
+        __limpet_drain_group(test);
+        break;
+
+    default:
+        break;
+    }
+}
+
+/*
+ * Called when timer_fd expires to act on every test whose deadline has
+ * passed. The mutex isn't held while doing so, since only the supervisor
+ * changes proc_state once a test is running.
+ */
+static void __limpet_handle_deadlines(void) {
+    struct timespec now;
+    uint64_t expirations;
+
+    if (read(__limpet_supervisor.timer_fd, &expirations,
+        sizeof(expirations)) == -1 && errno != EAGAIN) {
+        __limpet_fail_errno("read(timer_fd) failed");
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+        __limpet_fail_errno("clock_gettime failed");
+    }
+
+    for (;;) {
+        struct __limpet_test *p;
+
+        __limpet_mutex_lock(&__limpet_supervisor.mutex);
+
+        if (__limpet_supervisor.n_deadlines == 0 ||
+            __limpet_timespec_before(&now,
+            &__limpet_supervisor.deadlines[0]->sysdep.deadline)) {
+            __limpet_mutex_unlock(&__limpet_supervisor.mutex);
+            break;
+        }
+
+        p = __limpet_supervisor.deadlines[0];
+        __limpet_remove_deadline(p);
+
+        __limpet_mutex_unlock(&__limpet_supervisor.mutex);
+
+        __limpet_expire(p);
+    }
+}
+
+/*
+ * Returns: true if pid is the process of a running test. Must be called
+ *      with the mutex held.
+ */
+static bool __limpet_is_test_pid(pid_t pid) {
+    struct __limpet_test *p;
+
+    for (p = __limpet_supervisor.running; p != NULL;
+        p = p->sysdep.running_next) {
+        if (p->sysdep.pid == pid) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Reap processes left behind by tests that have exited, with
+ * __limpet_reap_orphans(). The exit status of a running test is left for
+ * __limpet_reap(). Nothing is reaped while a test is being started, since
+ * it could have exited before it has been put on the list of running tests.
+ */
+static void __limpet_sweep_orphans(void) {
+    __limpet_mutex_lock(&__limpet_supervisor.mutex);
+    if (__limpet_supervisor.starting == 0) {
+        __limpet_reap_orphans(__limpet_is_test_pid);
+    }
+    __limpet_mutex_unlock(&__limpet_supervisor.mutex);
+}
+
+/*
+ * The test process has exited, so reap it
+ */
+static void __limpet_reap(struct __limpet_test *test) {
+    if (wait4(test->sysdep.pid, &test->sysdep.exit_status, 0,
+        &test->sysdep.rusage) == -1) {
+        __limpet_fail_errno("wait4 failed");
+    }
+    test->duration = __limpet_now() - test->start_time;
+    __limpet_perf_read(test);
+
+    __limpet_unwatch_fd(test->sysdep.pid_fd);
+    test->sysdep.pid_fd = -1;
+
+    __limpet_sweep_orphans();
+
+    __limpet_mutex_lock(&__limpet_supervisor.mutex);
+    __limpet_remove_deadline(test);
+    __limpet_mutex_unlock(&__limpet_supervisor.mutex);
+
+    __limpet_drain_group(test);
+}
+
+/*
+ * Size of the buffer used to copy output when it can't be spliced
+ */
+#define __LIMPET_COPY_SIZE  (64 * 1024)
+
+/*
+ * When there is a log limit, the log is split into a head, which holds the
+ * first half of the limit, and a tail, which is used as a ring buffer
+ * holding the most recent output.
+ */
+static off_t __limpet_log_head_size(void) {
+    return __limpet_linux_params.log_limit / 2;
+}
+
+static off_t __limpet_log_tail_size(void) {
+    return __limpet_linux_params.log_limit - __limpet_log_head_size();
+}
+
+/*
+ * Find where a byte of output is kept in the log
+ * offset - offset of the byte in the output
+ * room - set to the number of bytes that can be kept contiguously from
+ *      there
+ *
+ * Returns: the offset in the log
+ */
+static off_t __limpet_log_position(off_t offset, size_t *room) {
+    off_t head;
+    off_t tail;
+    off_t in_tail;
+
+    head = __limpet_log_head_size();
+    tail = __limpet_log_tail_size();
+
+    if (__limpet_linux_params.log_limit == 0) {
+        *room = SSIZE_MAX;
+        return offset;
+    }
+
+    if (offset < head) {
+        *room = head - offset;
+        return offset;
+    }
+
+    in_tail = (offset - head) % tail;
+    *room = tail - in_tail;
+    return head + in_tail;
+}
+
+/*
+ * Returns: the number of bytes of output that didn't fit within the log
+ *      limit
+ */
+static off_t __limpet_log_dropped(struct __limpet_test *test) {
+    if (__limpet_linux_params.log_limit == 0 ||
+        test->sysdep.log_bytes <= __limpet_linux_params.log_limit) {
+        return 0;
+    }
+
+    return test->sysdep.log_bytes - __limpet_linux_params.log_limit;
+}
+
+/*
+ * Move output from a pipe into the log without copying it through user
+ * space. This doesn't work with every kind of file system, in which case
+ * *can_splice is set to false.
+ *
+ * Returns: the number of bytes moved, zero at end of file, or -1 with
+ *      errno set
+ */
+static ssize_t __limpet_splice_output(struct __limpet_test *test,
+    off_t pos, size_t room, bool *can_splice) {
+    ssize_t zrc;
+
+    zrc = splice(test->sysdep.capture_fd, NULL, test->sysdep.log_fd, &pos,
+        MIN(room, (size_t)__LIMPET_PIPE_SIZE),
+        SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (zrc == -1 && errno == EINVAL) {
+        *can_splice = false;
+    }
+
+    return zrc;
+}
+
+/*
+ * Copy output that is ready on the pipe or pseudoterminal into the log.
+ * This keeps going until there is nothing more to read, so that a test
+ * writing a lot of output needs as few trips through epoll as possible.
+ */
+static void __limpet_copy_output(struct __limpet_test *test) {
+    static bool can_splice = true;
+    char buf[__LIMPET_COPY_SIZE];
+    ssize_t zrc;
+
+    for (;;) {
+        size_t room;
+        off_t pos;
+
+        pos = __limpet_log_position(test->sysdep.log_bytes, &room);
+
+        if (!__limpet_linux_params.pty && can_splice) {
+            zrc = __limpet_splice_output(test, pos, room, &can_splice);
+            if (zrc == -1 && !can_splice) {
+                continue;
+            }
+        } else {
+            zrc = read(test->sysdep.capture_fd, buf, MIN(room, sizeof(buf)));
+            if (zrc > 0 && pwrite(test->sysdep.log_fd, buf, zrc, pos) != zrc) {
+                __limpet_fail_errno("log write failed");
+            }
+        }
+
+        if (zrc > 0) {
+            test->sysdep.log_bytes += zrc;
+            continue;
+        }
+
+        if (zrc == -1) {
+            if (errno == EAGAIN) {
+                return;
+            }
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            /*
+             * I would have expected a zero return when the other end of
+             * the pseudoterminal was closed, but seem to get this
+             */
+            if (errno != EIO) {
+                __limpet_fail_errno("output capture failed");
+            }
+        }
+
+        __limpet_unwatch_fd(test->sysdep.capture_fd);
+        test->sysdep.capture_fd = -1;
+        test->sysdep.io_state = __limpet_io_eof;
+        return;
+    }
+}
+
+/*
+ * Read captured output from the log, starting at the given offset in the
+ * output. The part of the output in the tail may wrap around, so this may
+ * take more than one read. If output was dropped, this stops at the end of
+ * the head.
+ *
+ * Returns: the number of bytes read, which is zero at the end of the
+ *      output
+ */
+static size_t __limpet_log_read(struct __limpet_test *test, char *buf,
+    size_t size, off_t offset) {
+    size_t total;
+
+    size = MIN(size, (size_t)(test->sysdep.log_bytes - offset));
+    if (__limpet_log_dropped(test) != 0 &&
+        offset < __limpet_log_head_size()) {
+        size = MIN(size, (size_t)(__limpet_log_head_size() - offset));
+    }
+
+    for (total = 0; total < size; ) {
+        size_t room;
+        off_t pos;
+        ssize_t zrc;
+
+        pos = __limpet_log_position(offset + total, &room);
+        zrc = pread(test->sysdep.log_fd, buf + total,
+            MIN(room, size - total), pos);
+        if (zrc == -1) {
+            __limpet_fail_errno("Unable to read log for %s", test->name);
+        }
+        if (zrc == 0) {
+            break;
+        }
+        total += zrc;
+    }
+
+    return total;
+}
+
+/*
+ * Size of the buffer in which streamed lines are collected before being
+ * written
+ */
+#define __LIMPET_STREAM_SIZE (16 * 1024)
+
+/*
+ * Collects streamed output so that it can be written to stdout in large
+ * pieces
+ * buf - the collected output
+ * used - the number of bytes of buf in use
+ */
+struct __limpet_stream_buf {
+    char    buf[__LIMPET_STREAM_SIZE];
+    size_t  used;
+};
+
+/*
+ * Write streamed output straight to the stdout file descriptor
+ */
+static void __limpet_stream_write(const char *buf, size_t size) {
+    while (size != 0) {
+        ssize_t zrc;
+
+        zrc = write(STDOUT_FILENO, buf, size);
+        if (zrc == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            __limpet_fail_errno("Unable to write streamed output");
+        }
+        buf += zrc;
+        size -= zrc;
+    }
+}
+
+static void __limpet_stream_flush(struct __limpet_stream_buf *out) {
+    __limpet_stream_write(out->buf, out->used);
+    out->used = 0;
+}
+
+static void __limpet_stream_append(struct __limpet_stream_buf *out,
+    const char *buf, size_t size) {
+    if (out->used + size > sizeof(out->buf)) {
+        __limpet_stream_flush(out);
+        if (size > sizeof(out->buf)) {
+            __limpet_stream_write(buf, size);
+            return;
+        }
+    }
+
+    memcpy(out->buf + out->used, buf, size);
+    out->used += size;
+}
+
+/*
+ * Add a line of streamed output, prefixed by the test name and the number
+ * of seconds since the test started. Output captured with a
+ * pseudoterminal has a carriage return before the newline, which is
+ * dropped.
+ */
+static void __limpet_stream_line(struct __limpet_stream_buf *out,
+    struct __limpet_test *test, double elapsed, const char *line,
+    size_t size) {
+    char prefix[256];
+    int prefix_size;
+
+    if (size != 0 && line[size - 1] == '\r') {
+        size--;
+    }
+
+    prefix_size = snprintf(prefix, sizeof(prefix), "[%s +%.3fs] ",
+        test->name, elapsed);
+    if (prefix_size < 0) {
+        __limpet_fail_errno("Unable to format streamed output");
+    }
+
+    __limpet_stream_append(out, prefix,
+        MIN((size_t)prefix_size, sizeof(prefix) - 1));
+    __limpet_stream_append(out, line, size);
+    __limpet_stream_append(out, "\n", 1);
+}
+
+/*
+ * Print the complete lines that have been added to the log since the last
+ * call. Once all output has been captured, any partial line at the end is
+ * printed, too.
+ *
+ * The lines are written with write() rather than stdio. A test process
+ * started by a raw clone() inherits any lock another thread holds at the
+ * time, so this thread must never hold the stdout lock while the main
+ * thread may be starting a test. output_mutex keeps the lines from
+ * different tests, and the reports printed by the main thread, from
+ * getting mixed together.
+ */
+static void __limpet_stream_output(struct __limpet_test *test) {
+    static struct __limpet_stream_buf out;
+    char buf[__LIMPET_COPY_SIZE];
+    double elapsed;
+    bool at_eof;
+    off_t head;
+    off_t oldest;
+    size_t n;
+
+    elapsed = __limpet_now() - test->start_time;
+    at_eof = test->sysdep.io_state == __limpet_io_eof;
+    head = __limpet_log_head_size();
+
+    __limpet_mutex_lock(&__limpet_supervisor.output_mutex);
+
+    for (;;) {
+        const char *p;
+        const char *end;
+
+        /*
+         * If the output came in faster than the log limit allows us to
+         * keep it, some of it is gone
+         */
+        oldest = test->sysdep.log_bytes - __limpet_log_tail_size();
+        if (__limpet_log_dropped(test) != 0 &&
+            test->sysdep.stream_offset >= head &&
+            test->sysdep.stream_offset < oldest) {
+            char note[64];
+            int note_size;
+
+            note_size = snprintf(note, sizeof(note),
+                "... %lld bytes of output dropped ...",
+                (long long)(oldest - test->sysdep.stream_offset));
+            __limpet_stream_line(&out, test, elapsed, note, note_size);
+            test->sysdep.stream_offset = oldest;
+        }
+
+        n = __limpet_log_read(test, buf, sizeof(buf),
+            test->sysdep.stream_offset);
+        if (n == 0) {
+            break;
+        }
+
+        /*
+         * Only print up to the last newline unless the line is too long
+         * to fit in the buffer, the rest of it was dropped, or there will
+         * be no more output
+         */
+        for (end = buf + n; end != buf && end[-1] != '\n'; end--) {
+        }
+        if (end == buf) {
+            if (n == sizeof(buf) || at_eof ||
+                (__limpet_log_dropped(test) != 0 &&
+                test->sysdep.stream_offset + (off_t)n == head)) {
+                end = buf + n;
+            } else {
+                break;
+            }
+        }
+
+        for (p = buf; p < end; ) {
+            const char *nl;
+
+            nl = (const char *)memchr(p, '\n', end - p);
+            if (nl == NULL) {
+                nl = end;
+            }
+
+            __limpet_stream_line(&out, test, elapsed, p, nl - p);
+            p = nl + 1;
+        }
+
+        test->sysdep.stream_offset += end - buf;
+    }
+
+    __limpet_stream_flush(&out);
+    __limpet_mutex_unlock(&__limpet_supervisor.output_mutex);
+}
+
+/*
+ * If the test process has been reaped and all of its output is in the
+ * log, the test is complete. Take it off the list of running tests and
+ * hand it over for reporting.
+ */
+static void __limpet_check_complete(struct __limpet_test *test) {
+    struct __limpet_test **pp;
+
+    if (test->sysdep.proc_state != __limpet_proc_reaped ||
+        test->sysdep.io_state != __limpet_io_eof) {
+        return;
     }
 
-    __limpet_log_and_wait(test);
+    __limpet_mutex_lock(&__limpet_supervisor.mutex);
+    for (pp = &__limpet_supervisor.running; *pp != test;
+        pp = &(*pp)->sysdep.running_next) {
+    }
+    *pp = test->sysdep.running_next;
+    __limpet_mutex_unlock(&__limpet_supervisor.mutex);
 
     if (test->sysdep.timedout) {
         __limpet_inc_failed();
@@ -625,34 +1719,507 @@ static void *__limpet_run_one(void *arg) {
             __limpet_inc_passed();
             __limpet_enqueue_done(test);
     }
+}
+
+/*
+ * The supervisor thread. This waits for events on the pidfd and raw
+ * pseudoterminal of every running test, copying output into the logs,
+ * reaping processes and killing any that run too long.
+ */
+static void *__limpet_supervise(void *arg) {
+    struct epoll_event events[__LIMPET_MAX_EVENTS];
+
+    for (;;) {
+        int n;
+        int i;
+
+        n = epoll_wait(__limpet_supervisor.epoll_fd, events,
+            __LIMPET_ARRAY_SIZE(events), -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            __limpet_fail_errno("epoll_wait failed");
+        }
+
+        for (i = 0; i < n; i++) {
+            struct __limpet_watch *watch;
+            struct __limpet_test *test;
+
+            watch = (struct __limpet_watch *)events[i].data.ptr;
+            test = watch->test;
 
-    return test;
+            if (test == NULL) {
+                __limpet_handle_deadlines();
+                continue;
+            }
+
+            if (watch->is_pid_fd) {
+                __limpet_reap(test);
+            } else {
+                __limpet_copy_output(test);
+                if (__limpet_linux_params.stream) {
+                    __limpet_stream_output(test);
+                }
+                __limpet_check_complete(test);
+            }
+        }
+    }
+
+    return NULL;
 }
 
 /*
- * Run one test
- *  test - Pointer to a __limpet_test for the test to run
+ * Set up the supervisor and start its thread
  */
-static void __limpet_start_one(struct __limpet_test *test) {
+static void __limpet_sysdep_init(void) {
     int rc;
 
-    rc = pthread_create(&test->sysdep.thread, NULL, __limpet_run_one,
-        test);
+    __limpet_zygote.sock = -1;
+    if (__limpet_linux_params.zygote) {
+        __limpet_start_zygote();
+    }
+
+    /*
+     * Processes a test leaves behind when it exits are reparented to us,
+     * so that we can reap them while making sure its process group is
+     * gone, along with any that left the group, which are reaped by
+     * __limpet_reap_orphans(). This isn't inherited by the zygote.
+     */
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1) == -1) {
+        __limpet_warn_errno("Unable to become a child subreaper");
+    }
+
+    __limpet_supervisor.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (__limpet_supervisor.epoll_fd == -1) {
+        __limpet_fail_errno("epoll_create1 failed");
+    }
+
+    __limpet_supervisor.timer_fd = timerfd_create(CLOCK_MONOTONIC,
+        TFD_CLOEXEC | TFD_NONBLOCK);
+    if (__limpet_supervisor.timer_fd == -1) {
+        __limpet_fail_errno("timerfd_create failed");
+    }
+
+    __limpet_supervisor.timer_watch.test = NULL;
+    __limpet_watch_fd(__limpet_supervisor.timer_fd,
+        &__limpet_supervisor.timer_watch);
+
+    __limpet_mutex_init(&__limpet_supervisor.mutex);
+    __limpet_mutex_init(&__limpet_supervisor.output_mutex);
+    __limpet_supervisor.running = NULL;
+    __limpet_supervisor.starting = 0;
+    __limpet_supervisor.deadlines = NULL;
+    __limpet_supervisor.n_deadlines = 0;
+    __limpet_supervisor.deadlines_size = 0;
+
+    rc = pthread_create(&__limpet_supervisor.thread, NULL,
+        __limpet_supervise, NULL);
     if (rc != 0) {
-        __limpet_fail_with(rc, "Failed to create thread");
+        __limpet_fail_with(rc, "Failed to create supervisor thread");
     }
 }
 
 /*
- * Wait for a thread and clean things up
+ * Size of the buffer in which translated log output is collected before
+ * being written
  */
-static void __limpet_cleanup_test(struct __limpet_test *test) {
-    int rc;
+#define __LIMPET_DUMP_SIZE  (1024 * 1024)
 
-    rc = pthread_join(test->sysdep.thread, NULL);
-    if (rc != 0) {
-        __limpet_fail_with(rc, "pthread_join failed");
+/*
+ * Collects translated log output so that it can be written in large
+ * pieces
+ * buf - the collected output
+ * used - the number of bytes of buf in use
+ */
+struct __limpet_dump_buf {
+    char    *buf;
+    size_t  used;
+};
+
+static void __limpet_dump_write(const char *buf, size_t size) {
+    if (fwrite(buf, 1, size, stdout) != size) {
+        __limpet_fail_errno("Unable to write log");
+    }
+}
+
+static void __limpet_dump_flush(struct __limpet_dump_buf *out) {
+    __limpet_dump_write(out->buf, out->used);
+    out->used = 0;
+}
+
+static void __limpet_dump_append(struct __limpet_dump_buf *out,
+    const char *buf, size_t size) {
+    if (out->used + size > __LIMPET_DUMP_SIZE) {
+        __limpet_dump_flush(out);
+    }
+
+    if (size > __LIMPET_DUMP_SIZE) {
+        __limpet_dump_write(buf, size);
+    } else {
+        memcpy(out->buf + out->used, buf, size);
+        out->used += size;
+    }
+}
+
+/*
+ * Find the first occurrence of c in [p, end), or end if there is none
+ */
+static const char *__limpet_find(const char *p, const char *end, char c) {
+    const char *found;
+
+    found = (const char *)memchr(p, c, end - p);
+    return found == NULL ? end : found;
+}
+
+/*
+ * Convert carriage return-linefeed sequences in output captured with a
+ * pseudoterminal to a simple linefeed. Everything between carriage returns
+ * and linefeeds is copied in one piece, and memchr() is used to find them.
+ * last_was_cr - whether the last character of the previous piece of the
+ *      log was a carriage return. This is updated for the next piece.
+ */
+static void __limpet_dump_translated(const char *log, size_t size,
+    bool *last_was_cr_p) {
+    struct __limpet_dump_buf out;
+    const char *p;
+    const char *end;
+    const char *cr;
+    const char *lf;
+    bool last_was_cr;
+
+    out.buf = (char *)malloc(__LIMPET_DUMP_SIZE);
+    if (out.buf == NULL) {
+        __limpet_fail("Out of memory allocating %d bytes\n",
+            __LIMPET_DUMP_SIZE);
+    }
+    out.used = 0;
+
+    p = log;
+    end = log + size;
+    cr = __limpet_find(p, end, '\r');
+    lf = __limpet_find(p, end, '\n');
+    last_was_cr = *last_was_cr_p;
+
+    while (p < end) {
+        const char *special;
+
+        if (cr < p) {
+            cr = __limpet_find(p, end, '\r');
+        }
+        if (lf < p) {
+            lf = __limpet_find(p, end, '\n');
+        }
+
+        special = MIN(cr, lf);
+        if (special > p) {
+            __limpet_dump_append(&out, p, special - p);
+            last_was_cr = false;
+            p = special;
+            continue;
+        }
+
+        if (*p == '\n') {
+            if (last_was_cr) {
+                __limpet_dump_append(&out, "\n", 1);
+                last_was_cr = false;
+            }
+        } else if (last_was_cr) {
+            __limpet_dump_append(&out, "\r", 1);
+        } else {
+            last_was_cr = true;
+        }
+        p++;
+    }
+
+    __limpet_dump_flush(&out);
+    free(out.buf);
+    *last_was_cr_p = last_was_cr;
+}
+
+/*
+ * Dump one contiguous piece of the log
+ */
+static void __limpet_dump_piece(const char *log, size_t size,
+    bool *last_was_cr) {
+    if (__limpet_linux_params.pty) {
+        __limpet_dump_translated(log, size, last_was_cr);
+    } else {
+        __limpet_dump_write(log, size);
+    }
+}
+
+/*
+ * Close the log of a test once it has been printed, or isn't needed
+ */
+static void __limpet_close_log(struct __limpet_test *test) {
+    if (close(test->sysdep.log_fd) != 0) {
+        __limpet_warn_errno("Close of log file failed");
+    }
+    test->sysdep.log_fd = -1;
+}
+
+/*
+ * This dumps the log file to standard out. If the output was captured with
+ * a pseudoterminal, we're going to have to convert carriage return/linefeed
+ * sequences to newlines.
+ *
+ * Returns the number of bytes in the log, or -1 if it couldn't be read
+ */
+static ssize_t __limpet_dump_stored_log(struct __limpet_test *test) {
+    void *map;
+    size_t size;
+
+    if (!__limpet_capture_output()) {
+        return 1;
     }
+
+    /*
+     * When streaming, the output of tests that passed has already been
+     * seen, so only the logs of failures are printed again
+     */
+    if (__limpet_linux_params.stream && __limpet_test_passed(test)) {
+        __limpet_close_log(test);
+        return 0;
+    }
+
+    size = test->sysdep.log_bytes - __limpet_log_dropped(test);
+
+    if (size != 0) {
+        const char *log;
+        off_t dropped;
+        bool last_was_cr;
+
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, test->sysdep.log_fd,
+            0);
+        if (map == MAP_FAILED) {
+            __limpet_warn_errno("Unable to map log file");
+            __limpet_close_log(test);
+            return -1;
+        }
+
+        (void)madvise(map, size, MADV_SEQUENTIAL);
+        log = (const char *)map;
+        last_was_cr = false;
+
+        /*
+         * If output was dropped, print the head, say how much was lost,
+         * then print the tail starting with its oldest byte
+         */
+        dropped = __limpet_log_dropped(test);
+        if (dropped == 0) {
+            __limpet_dump_piece(log, size, &last_was_cr);
+        } else {
+            off_t head;
+            off_t tail;
+            off_t oldest;
+
+            head = __limpet_log_head_size();
+            tail = __limpet_log_tail_size();
+            oldest = (test->sysdep.log_bytes - head) % tail;
+
+            __limpet_dump_piece(log, head, &last_was_cr);
+            if (head != 0 && log[head - 1] != '\n') {
+                __limpet_dump_write("\n", 1);
+            }
+            fprintf(stdout, "> ... %lld bytes of output dropped ...\n",
+                (long long)dropped);
+            last_was_cr = false;
+            __limpet_dump_piece(log + head + oldest, tail - oldest,
+                &last_was_cr);
+            __limpet_dump_piece(log + head, oldest, &last_was_cr);
+        }
+
+        if (munmap(map, size) == -1) {
+            __limpet_warn_errno("Unable to unmap log file");
+        }
+    }
+
+    __limpet_close_log(test);
+
+    return size;
+}
+
+/*
+ * Put a test that has been started on the list of running tests and have
+ * the supervisor watch its process, if it has one, and its output
+ */
+static void __limpet_supervise_test(struct __limpet_test *test) {
+    /*
+     * If we aren't capturing output, we have nothing to read and are
+     * effectively at the EOF
+     */
+    test->sysdep.proc_state = __limpet_proc_running;
+    test->sysdep.io_state = __limpet_capture_output() ? __limpet_io_read :
+        __limpet_io_eof;
+    test->sysdep.log_bytes = 0;
+    test->sysdep.stream_offset = 0;
+    test->sysdep.pid_watch.test = test;
+    test->sysdep.capture_watch.test = test;
+
+    /*
+     * A timeout of zero means the test can run forever
+     */
+    __limpet_mutex_lock(&__limpet_supervisor.mutex);
+    test->sysdep.running_next = __limpet_supervisor.running;
+    __limpet_supervisor.running = test;
+    if (test->params->timeout != 0 && test->sysdep.pid_fd != -1) {
+        __limpet_deadline(test->params->timeout, &test->sysdep.deadline);
+        __limpet_add_deadline(test);
+    }
+    __limpet_mutex_unlock(&__limpet_supervisor.mutex);
+
+    if (test->sysdep.pid_fd != -1) {
+        __limpet_watch_fd(test->sysdep.pid_fd, &test->sysdep.pid_watch);
+    }
+    if (__limpet_capture_output()) {
+        __limpet_watch_fd(test->sysdep.capture_fd,
+            &test->sysdep.capture_watch);
+    }
+}
+
+/*
+ * Run one test as a subprocess and hand it over to the supervisor
+ *  test - Pointer to a __limpet_test for the test to run
+ */
+static void __limpet_start_one(struct __limpet_test *test) {
+    pid_t pid;
+
+    __limpet_test_setup(test);
+
+    /*
+     * Anything still in the stdout buffer must be written before streamed
+     * output, which doesn't go through the buffer, and must not be
+     * inherited by the test
+     */
+    if (fflush(stdout) == -1) {
+        __limpet_fail_errno("fflush(stdout) failed");
+    }
+
+    /*
+     * Keep the supervisor from taking this test for a process left behind
+     * by another until it is on the list of running tests
+     */
+    __limpet_mutex_lock(&__limpet_supervisor.mutex);
+    __limpet_supervisor.starting++;
+    __limpet_mutex_unlock(&__limpet_supervisor.mutex);
+
+    if (__limpet_zygote.sock != -1) {
+        pid = __limpet_zygote_fork(test, &test->sysdep.pid_fd);
+    } else {
+        pid = __limpet_spawn(test, __limpet_linux_params.spawn,
+            test->sysdep.tty, &test->sysdep.pid_fd);
+    }
+
+    switch (pid) {
+    case 0:
+        /*
+         * Nothing should have been written to the stdout buffer since the
+         * fflush(), but the parent will print anything that was, so don't
+         * let it end up in this test's log
+         */
+        __fpurge(stdout);
+        __limpet_new_process_group();
+        __limpet_setup_std_fds(&test->sysdep);
+        __limpet_call_test(test);
+        __limpet_exit(false);
+        break;
+
+    default:
+        if (close(test->sysdep.tty) == -1) {
+            __limpet_fail_errno("close(test->tty) failed");
+        }
+        test->sysdep.tty = -1;
+        test->sysdep.pid = pid;
+        break;
+    }
+
+    /*
+     * We need a file descriptor for this pid so the supervisor can use
+     * epoll to wait for it to exit. If the zygote couldn't get one, get it
+     * now.
+     */
+    if (test->sysdep.pid_fd == -1) {
+        test->sysdep.pid_fd = syscall(SYS_pidfd_open, test->sysdep.pid, 0);
+        if (test->sysdep.pid_fd == -1) {
+            __limpet_fail_errno("pidfd_open failed for pid %d",
+                test->sysdep.pid);
+        }
+    }
+
+    if (test->params->perf) {
+        __limpet_perf_attach(test);
+    }
+
+    __limpet_supervise_test(test);
+
+    __limpet_mutex_lock(&__limpet_supervisor.mutex);
+    __limpet_supervisor.starting--;
+    __limpet_mutex_unlock(&__limpet_supervisor.mutex);
+}
+
+/*
+ * Run a test in this process. Its output goes through the pipe or
+ * pseudoterminal to the supervisor, which copies it into the log just as
+ * for a test with a process of its own, and completes the test once it
+ * has all of it. A test run this way can't be timed out. Meanwhile, the
+ * supervisor prints its warnings and failures to the standard output and
+ * error we had before, which __limpet_redirect_std_fds() keeps.
+ *
+ * When streaming, the supervisor can wait for stdout while printing, which
+ * would keep it from emptying the pipe while this test fills it, so the
+ * test is given a process of its own instead.
+ */
+static void __limpet_start_inproc(struct __limpet_test *test) {
+    struct rusage start;
+    int saved[3];
+    bool passed;
+
+    if (__limpet_linux_params.stream) {
+        __limpet_start_one(test);
+        return;
+    }
+
+    __limpet_test_setup(test);
+    __limpet_supervise_test(test);
+
+    if (getrusage(RUSAGE_THREAD, &start) == -1) {
+        __limpet_fail_errno("getrusage failed");
+    }
+
+    __limpet_redirect_std_fds(test->sysdep.tty, saved);
+    passed = __limpet_call_inproc(test);
+    __limpet_restore_std_fds(saved);
+
+    __limpet_rusage_since(RUSAGE_THREAD, &start, &test->sysdep.rusage);
+    test->duration = __limpet_now() - test->start_time;
+    test->sysdep.exit_status = W_EXITCODE(passed ? EXIT_SUCCESS :
+        EXIT_FAILURE, 0);
+
+    __limpet_mutex_lock(&__limpet_supervisor.mutex);
+    test->sysdep.proc_state = __limpet_proc_reaped;
+    __limpet_mutex_unlock(&__limpet_supervisor.mutex);
+
+    /*
+     * Closing our end lets the supervisor see the end of the output, and
+     * complete the test. If output isn't captured, there is nothing for
+     * the supervisor to see, so we complete it ourselves.
+     */
+    if (close(test->sysdep.tty) == -1) {
+        __limpet_fail_errno("close(test->tty) failed");
+    }
+    test->sysdep.tty = -1;
+
+    if (!__limpet_capture_output()) {
+        __limpet_check_complete(test);
+    }
+}
+
+/*
+ * Nothing to clean up, the supervisor has already closed everything but
+ * the log
+ */
+static void __limpet_cleanup_test(struct __limpet_test *test) {
 }
 
 /*
@@ -678,13 +2245,26 @@ static int __limpet_pre_stored(struct __limpet_test *test,
     const char *sep) {
     int n;
 
+    /*
+     * Keep streamed output from showing up in the middle of the report
+     */
+    __limpet_mutex_lock(&__limpet_supervisor.output_mutex);
     n = __limpet_print_test_header(test, sep);
 
     return n;
 }
 
+/*
+ * Streamed output is written straight to the file descriptor, so the
+ * report has to be out of the stdout buffer before the supervisor can
+ * write any more
+ */
 static void __limpet_post_stored(struct __limpet_test *test, int n) {
 
     __limpet_print_test_trailer(test, n);
+    if (fflush(stdout) == -1) {
+        __limpet_fail_errno("fflush(stdout) failed");
+    }
+    __limpet_mutex_unlock(&__limpet_supervisor.output_mutex);
 }
 #endif /* _LEAVEIN_TEST_LINUX_H_ */
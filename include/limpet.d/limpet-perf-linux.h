@@ -0,0 +1,181 @@
+/*
+ * Performance counters for test processes, shared by the Linux versions of
+ * Limpet. The counters are opened with perf_event_open() on the test
+ * process by the process running the tests, as soon as it has started it,
+ * and are inherited by any threads or processes the test starts. The test
+ * process waits until they are open before calling the test function, so
+ * that nothing the test does goes uncounted. Whatever the test process
+ * does before then is counted too, which, for a test started by the exec
+ * strategy, includes starting the test executable. The counters are read
+ * once the test process has been reaped, so they are there however it
+ * ended, including from a signal, _exit() or a timeout.
+ *
+ * Each counter is opened on its own, so one the system doesn't support,
+ * such as a hardware counter in a virtual machine without a virtual PMU,
+ * is simply left out. If the kernel won't count kernel activity for us,
+ * because of the perf_event_paranoid setting, only user space activity is
+ * counted.
+ */
+
+#ifndef _LIMPET_PERF_LINUX_H_
+#define _LIMPET_PERF_LINUX_H_
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * The event for each counter, in the order of enum __limpet_perf_counter
+ */
+static const struct {
+    uint32_t    type;
+    uint64_t    config;
+} __limpet_perf_events[] = {
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+};
+
+/*
+ * Open a counter for a test process
+ *
+ * Returns: the file descriptor for the counter, or -1 if it couldn't be
+ *      opened
+ */
+static int __limpet_perf_open(enum __limpet_perf_counter counter,
+    pid_t pid) {
+    struct perf_event_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = __limpet_perf_events[counter].type;
+    attr.config = __limpet_perf_events[counter].config;
+    attr.inherit = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+        PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    fd = syscall(SYS_perf_event_open, &attr, pid, -1, -1,
+        PERF_FLAG_FD_CLOEXEC);
+    if (fd == -1 && (errno == EACCES || errno == EPERM)) {
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(SYS_perf_event_open, &attr, pid, -1, -1,
+            PERF_FLAG_FD_CLOEXEC);
+    }
+
+    return fd;
+}
+
+/*
+ * Running in the process running the tests, open the counters on a test
+ * process that has just been started and let it go on to run the test
+ */
+static void __limpet_perf_attach(struct __limpet_test *test) {
+    size_t i;
+
+    if (test->results == NULL) {
+        return;
+    }
+
+    test->sysdep.perf_fds = (int *)malloc(sizeof(test->sysdep.perf_fds[0]) *
+        __LIMPET_PERF_COUNTERS);
+    if (test->sysdep.perf_fds == NULL) {
+        __limpet_fail("Out of memory allocating performance counters\n");
+    }
+
+    for (i = 0; i < __LIMPET_PERF_COUNTERS; i++) {
+        test->sysdep.perf_fds[i] = __limpet_perf_open(
+            (enum __limpet_perf_counter)i, test->sysdep.pid);
+    }
+
+    __atomic_store_n(&test->results->perf.attached, true, __ATOMIC_RELEASE);
+}
+
+/*
+ * Running in the test process, wait until the counters are open
+ */
+static void __limpet_perf_start(struct __limpet_test *test) {
+    if (test->results == NULL) {
+        return;
+    }
+
+    while (!__atomic_load_n(&test->results->perf.attached,
+        __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+}
+
+/*
+ * Running in the process running the tests, read the counters once the
+ * test process has been reaped
+ */
+static void __limpet_perf_read(struct __limpet_test *test) {
+    struct __limpet_perf_result *perf;
+    size_t i;
+
+    if (test->sysdep.perf_fds == NULL) {
+        return;
+    }
+
+    perf = &test->results->perf;
+
+    for (i = 0; i < __LIMPET_PERF_COUNTERS; i++) {
+        int fd = test->sysdep.perf_fds[i];
+        uint64_t values[3];
+
+        if (fd == -1) {
+            continue;
+        }
+
+        /*
+         * values holds the count and the times the counter was enabled and
+         * running. If there are more hardware counters open than the CPU
+         * has, they take turns and the count is scaled up to make up for
+         * the time the counter wasn't running.
+         */
+        if (read(fd, values, sizeof(values)) == sizeof(values) &&
+            values[2] != 0) {
+            perf->values[i] = values[2] < values[1] ?
+                (unsigned long long)((double)values[0] * values[1] /
+                values[2]) : values[0];
+            perf->counted[i] = true;
+        }
+
+        close(fd);
+    }
+
+    free(test->sysdep.perf_fds);
+    test->sysdep.perf_fds = NULL;
+}
+
+/*
+ * Print the counters that were read, for example:
+ *  task_clock_ns=1520347 page_faults=112 context_switches=2
+ */
+static void __limpet_print_perf(const struct __limpet_perf_result *perf) {
+    const char *sep;
+    size_t i;
+
+    sep = "";
+    for (i = 0; i < __LIMPET_PERF_COUNTERS; i++) {
+        if (perf->counted[i]) {
+            __limpet_printf("%s%s=%llu", sep, __limpet_perf_names[i],
+                perf->values[i]);
+            sep = " ";
+        }
+    }
+
+    if (*sep == '\0') {
+        __limpet_printf("unavailable");
+    }
+}
+#endif /* _LIMPET_PERF_LINUX_H_ */
@@ -5,10 +5,37 @@
 #ifndef _LIMPET_POSIX_H_
 #define _LIMPET_POSIX_H_
 
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <signal.h>
+#include <limits.h>
+#include <link.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Largest GNU build ID note we expect, in bytes. These are usually 20 byte
+ * SHA-1 hashes.
+ */
+#define __LIMPET_BUILD_ID_MAX   64
+
 #define __LIMPET_DEFINE_SIGNAME(signame) \
     {.number = SIG ## signame, .name = #signame}
 
-static void __limpet_print_signame(int sig) {
+/*
+ * Returns: the name of a signal without the leading "SIG", or NULL if it
+ *      isn't known
+ */
+static const char *__limpet_signame(int sig) {
     static const struct {
         int         number;
         const char* name;
@@ -52,14 +79,21 @@ static void __limpet_print_signame(int sig) {
 
     for (i = 0; i < __LIMPET_ARRAY_SIZE(signames); i++) {
         if (signames[i].number == sig) {
-            break;
+            return signames[i].name;
         }
     }
 
-    if (i == __LIMPET_ARRAY_SIZE(signames)) {
+    return NULL;
+}
+
+static void __limpet_print_signame(int sig) {
+    const char *name;
+
+    name = __limpet_signame(sig);
+    if (name == NULL) {
         __limpet_printf("signal unknown (%d)", sig);
     } else {
-        __limpet_printf("signal SIG%s (%d)", signames[i].name, sig);
+        __limpet_printf("signal SIG%s (%d)", name, sig);
     }
 }
 
@@ -69,6 +103,33 @@ static void __limpet_print_signame(int sig) {
  */
 #undef __LIMPET_DEFINE_SIGNAME
 
+/*
+ * Only the CPU time and file size limits are enforced with a signal that
+ * shows the limit was exceeded. When a test runs out of address space or
+ * open files, malloc(), mmap() or open() fail with ENOMEM or EMFILE, and
+ * whatever the test makes of that, often an assertion failure or a crash,
+ * is reported as an ordinary failure.
+ *
+ * Returns: a description of the resource whose limit the test exceeded, if
+ *      the way it exited shows that, otherwise NULL
+ */
+static const char *__limpet_rlimit_exceeded(int status) {
+    if (!WIFSIGNALED(status)) {
+        return NULL;
+    }
+
+    switch (WTERMSIG(status)) {
+    case SIGXCPU:
+        return "CPU time";
+
+    case SIGXFSZ:
+        return "file size";
+
+    default:
+        return NULL;
+    }
+}
+
 static void __limpet_print_status(struct __limpet_test *test) {
     int status = test->sysdep.exit_status;
 
@@ -88,8 +149,13 @@ static void __limpet_print_status(struct __limpet_test *test) {
     } else if (WIFSIGNALED(status)) {
         int sig;
         const char *core_dumped;
+        const char *exceeded;
 
         sig = WTERMSIG(status);
+        exceeded = __limpet_rlimit_exceeded(status);
+        if (exceeded != NULL) {
+            __limpet_printf("resource limit exceeded (%s), ", exceeded);
+        }
         __limpet_print_signame(sig);
 #ifdef WCOREDUMP
         core_dumped = WCOREDUMP(status) ? " (core dumped)" : "";
@@ -131,24 +197,74 @@ static void __limpet_print_status(struct __limpet_test *test) {
         __limpet_warn_with(errno, fmt, ##__VA_ARGS__); \
     } while (0)
 
+/*
+ * Where to go when a test run in the process running the tests fails,
+ * instead of exiting, or NULL if no such test is running. This is per
+ * thread so that a failure in any other thread still exits.
+ */
+__thread jmp_buf *__limpet_inproc_jmp __attribute((common));
+
+/*
+ * While a test run in the process running the tests has our standard
+ * input, output and error, other threads, such as the supervisor, print
+ * their warnings and failures to these duplicates of the standard output
+ * and error we had before, so that they don't end up in the test's log
+ * std_dups - the duplicates, made the first time they are needed, with -1
+ *      for one that wasn't open
+ * std_redirected - true while the test has our standard output and error
+ */
+static int __limpet_std_dups[3] = {-1, -1, -1};
+static bool __limpet_std_redirected;
+
+/*
+ * Returns: the file descriptor to print to instead of fd, which is
+ *      STDOUT_FILENO or STDERR_FILENO, or -1 to print to fd through
+ *      stdio as usual
+ */
+static int __limpet_diag_fd(int fd) {
+    if (__limpet_inproc_jmp != NULL ||
+        !__atomic_load_n(&__limpet_std_redirected, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+
+    return __limpet_std_dups[fd];
+}
+
 static void __limpet_fail(const char *fmt, ...) __attribute((noreturn));
 static void __limpet_fail(const char *fmt, ...) {
     va_list ap;
+    int fd;
 
+    fd = __limpet_diag_fd(STDERR_FILENO);
     va_start(ap, fmt);  
-    vfprintf(stderr, fmt, ap);
+    if (fd != -1) {
+        vdprintf(fd, fmt, ap);
+    } else {
+        vfprintf(stderr, fmt, ap);
+    }
     va_end(ap);
 
+    if (__limpet_inproc_jmp != NULL) {
+        longjmp(*__limpet_inproc_jmp, 1);
+    }
+
     __limpet_exit(true);
 }
 
 static void __limpet_warn(const char *fmt, ...) __attribute((unused));
 static void __limpet_warn(const char *fmt, ...) {
     va_list ap;
+    int fd;
 
-    printf("Warning: ");
+    fd = __limpet_diag_fd(STDOUT_FILENO);
     va_start(ap, fmt);  
-    vprintf(fmt, ap);
+    if (fd != -1) {
+        dprintf(fd, "Warning: ");
+        vdprintf(fd, fmt, ap);
+    } else {
+        printf("Warning: ");
+        vprintf(fmt, ap);
+    }
     va_end(ap);
 }
 
@@ -162,4 +278,818 @@ static int __limpet_printf(const char *fmt, ...) {
 
     return n;
 }
+
+static double __limpet_now(void) {
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+        __limpet_fail("clock_gettime failed: %s\n", strerror(errno));
+    }
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * Compute the time, on the CLOCK_MONOTONIC clock, at which a test started
+ * now will have run for the given number of seconds
+ */
+static void __limpet_deadline(double seconds, struct timespec *deadline) {
+    long long ns;
+
+    if (clock_gettime(CLOCK_MONOTONIC, deadline) == -1) {
+        __limpet_fail("clock_gettime failed: %s\n", strerror(errno));
+    }
+
+    ns = (long long)(seconds * 1e9);
+    deadline->tv_sec += ns / 1000000000;
+    deadline->tv_nsec += ns % 1000000000;
+    if (deadline->tv_nsec >= 1000000000) {
+        deadline->tv_sec += 1;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+/*
+ * Send a signal to the process group of a test, whose ID is the process ID
+ * of the test. If the test hasn't put itself in its own process group yet,
+ * signal just the test process.
+ */
+static void __limpet_signal_group(pid_t pgid, int sig) {
+    if (kill(-pgid, sig) == 0) {
+        return;
+    }
+
+    if (errno == ESRCH && kill(pgid, sig) == 0) {
+        return;
+    }
+
+    if (errno != ESRCH) {
+        __limpet_warn("Unable to send signal %d to process group %d: %s\n",
+            sig, pgid, strerror(errno));
+    }
+}
+
+/*
+ * Called after the test process has been reaped to kill anything the test
+ * left running in its process group. Whatever has been reparented to us
+ * and has exited is reaped.
+ *
+ * Returns: true if the process group is gone, false if something is still
+ *      in it and this should be called again
+ */
+static bool __limpet_kill_group(pid_t pgid) {
+    siginfo_t info;
+
+    if (kill(-pgid, SIGKILL) == -1) {
+        if (errno != ESRCH) {
+            __limpet_warn("Unable to kill process group %d: %s\n", pgid,
+                strerror(errno));
+        }
+        return true;
+    }
+
+    for (;;) {
+        memset(&info, 0, sizeof(info));
+        if (waitid(P_PGID, pgid, &info, WEXITED | WNOHANG) == -1 ||
+            info.si_pid == 0) {
+            break;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Resource limits that can be placed on tests. Each is given in a limit
+ * specification as name=value, where value is a number, optionally
+ * followed by K, M or G, or "unlimited".
+ */
+struct __limpet_rlimit_name {
+    const char  *name;
+    int         resource;
+    const char  *description;
+};
+
+static const struct __limpet_rlimit_name __limpet_rlimit_names[] = {
+    {.name = "as", .resource = RLIMIT_AS, .description = "address space"},
+    {.name = "cpu", .resource = RLIMIT_CPU, .description = "CPU time"},
+    {.name = "nofile", .resource = RLIMIT_NOFILE,
+        .description = "open files"},
+    {.name = "core", .resource = RLIMIT_CORE,
+        .description = "core file size"},
+    {.name = "fsize", .resource = RLIMIT_FSIZE,
+        .description = "file size"},
+};
+
+/*
+ * Limits parsed from a limit specification
+ * given - true for each entry of __limpet_rlimit_names that was given
+ * values - the value given for each entry
+ */
+struct __limpet_rlimits {
+    bool    given[__LIMPET_ARRAY_SIZE(__limpet_rlimit_names)];
+    rlim_t  values[__LIMPET_ARRAY_SIZE(__limpet_rlimit_names)];
+};
+
+/*
+ * List the names of the limits, such as "as, cpu or core", for messages
+ */
+static void __limpet_rlimit_choices(char *buf, size_t size) {
+    size_t n = __LIMPET_ARRAY_SIZE(__limpet_rlimit_names);
+    size_t len;
+    size_t i;
+
+    len = 0;
+    for (i = 0; i < n && len < size; i++) {
+        const char *sep;
+
+        if (i == 0) {
+            sep = "";
+        } else if (i + 1 < n) {
+            sep = ", ";
+        } else {
+            sep = " or ";
+        }
+        len += snprintf(buf + len, size - len, "%s%s", sep,
+            __limpet_rlimit_names[i].name);
+    }
+}
+
+/*
+ * Parse a space-separated list of limits, such as "as=512M cpu=10", and
+ * add them to limits, replacing any already there
+ * spec - the limits, or NULL for none
+ * what - what the limits are for, for error messages
+ */
+static void __limpet_parse_rlimits(const char *spec, const char *what,
+    struct __limpet_rlimits *limits) {
+    const char *p;
+
+    for (p = spec; p != NULL && *p != '\0';) {
+        const char *value;
+        char *endptr;
+        size_t len;
+        size_t name_len;
+        size_t i;
+        unsigned long long n;
+        unsigned shift;
+
+        p += strspn(p, " ");
+        len = strcspn(p, " ");
+        if (len == 0) {
+            continue;
+        }
+
+        value = (const char *)memchr(p, '=', len);
+        name_len = value == NULL ? len : (size_t)(value - p);
+        for (i = 0; i < __LIMPET_ARRAY_SIZE(__limpet_rlimit_names); i++) {
+            if (strlen(__limpet_rlimit_names[i].name) == name_len &&
+                strncmp(p, __limpet_rlimit_names[i].name, name_len) == 0) {
+                break;
+            }
+        }
+
+        if (value == NULL ||
+            i == __LIMPET_ARRAY_SIZE(__limpet_rlimit_names)) {
+            char names[128];
+
+            __limpet_rlimit_choices(names, sizeof(names));
+            __limpet_fail("Bad limit '%.*s' for %s: must be %s=value\n",
+                (int)len, p, what, names);
+        }
+
+        value++;
+        if ((size_t)(value - p) + strlen("unlimited") == len &&
+            strncmp(value, "unlimited", strlen("unlimited")) == 0) {
+            limits->given[i] = true;
+            limits->values[i] = RLIM_INFINITY;
+            p += len;
+            continue;
+        }
+
+        errno = 0;
+        n = strtoull(value, &endptr, 10);
+        shift = 0;
+        if (endptr != p + len) {
+            switch (*endptr) {
+            case 'K':
+                shift = 10;
+                endptr++;
+                break;
+
+            case 'M':
+                shift = 20;
+                endptr++;
+                break;
+
+            case 'G':
+                shift = 30;
+                endptr++;
+                break;
+
+            default:
+                break;
+            }
+        }
+
+        /*
+         * A value that reaches RLIM_INFINITY once scaled would be taken
+         * as no limit at all
+         */
+        if (endptr == value || endptr != p + len || errno != 0 ||
+            *value == '-' ||
+            n > ((unsigned long long)RLIM_INFINITY - 1) >> shift) {
+            __limpet_fail("Bad value in limit '%.*s' for %s\n", (int)len, p,
+                what);
+        }
+
+        limits->given[i] = true;
+        limits->values[i] = (rlim_t)(n << shift);
+        p += len;
+    }
+}
+
+/*
+ * Make sure that a limit specification can be parsed, failing if it can't
+ */
+static void __limpet_check_rlimits(const char *spec, const char *what) {
+    struct __limpet_rlimits limits;
+
+    memset(&limits, 0, sizeof(limits));
+    __limpet_parse_rlimits(spec, what, &limits);
+}
+
+/*
+ * Running in the context of a test child process, apply the limits given
+ * for all tests, then those given for this test. The soft limit is set to
+ * the value given. For CPU time, the hard limit is a second more, so that
+ * the test gets SIGXCPU, which identifies why it died, before SIGKILL.
+ */
+static void __limpet_apply_rlimits(struct __limpet_test *test) {
+    struct __limpet_rlimits limits;
+    size_t i;
+
+    if (test->params->rlimits == NULL && test->rlimits == NULL) {
+        return;
+    }
+
+    memset(&limits, 0, sizeof(limits));
+    __limpet_parse_rlimits(test->params->rlimits, "all tests", &limits);
+    __limpet_parse_rlimits(test->rlimits, test->name, &limits);
+
+    for (i = 0; i < __LIMPET_ARRAY_SIZE(__limpet_rlimit_names); i++) {
+        struct rlimit rlim;
+        int resource;
+
+        if (!limits.given[i]) {
+            continue;
+        }
+
+        resource = __limpet_rlimit_names[i].resource;
+        if (getrlimit(resource, &rlim) == -1) {
+            __limpet_fail_errno("getrlimit(%s) failed",
+                __limpet_rlimit_names[i].name);
+        }
+
+        rlim.rlim_cur = limits.values[i];
+        if (resource == RLIMIT_CPU && rlim.rlim_cur != RLIM_INFINITY &&
+            rlim.rlim_max == RLIM_INFINITY) {
+            rlim.rlim_max = rlim.rlim_cur + 1;
+        } else if (rlim.rlim_max != RLIM_INFINITY &&
+            (rlim.rlim_cur == RLIM_INFINITY ||
+            rlim.rlim_cur > rlim.rlim_max)) {
+            rlim.rlim_cur = rlim.rlim_max;
+        }
+
+        if (setrlimit(resource, &rlim) == -1) {
+            __limpet_fail_errno("Unable to set %s limit for test %s",
+                __limpet_rlimit_names[i].description, test->name);
+        }
+    }
+}
+
+/*
+ * Returns: true if time a is before time b
+ */
+static bool __limpet_timespec_before(const struct timespec *a,
+    const struct timespec *b) {
+    return a->tv_sec < b->tv_sec ||
+        (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/*
+ * Returns the name used to identify this test executable in the history
+ * file. This is the absolute path, if we can get it. The name we were
+ * invoked by can't be relied on for this, since it may have been found
+ * in PATH or be relative to a directory we have since left.
+ */
+static const char *__limpet_binary_name(void) {
+    static char path[PATH_MAX];
+    ssize_t len;
+
+    if (path[0] != '\0') {
+        return path;
+    }
+
+    len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (len > 0) {
+        path[len] = '\0';
+    } else if (realpath(program_invocation_name, path) == NULL) {
+        strncpy(path, program_invocation_name, sizeof(path) - 1);
+    }
+
+    return path;
+}
+
+/*
+ * Split a history file line of the form:
+ *      <binary><tab><test name><tab><duration><newline>
+ * into its fields. The tabs and newline are overwritten.
+ *
+ * Returns: true if the line was valid, false otherwise
+ */
+static bool __limpet_split_history(char *line, char **binary, char **name,
+    double *duration) {
+    char *tab;
+    char *endptr;
+
+    *binary = line;
+    tab = strchr(line, '\t');
+    if (tab == NULL) {
+        return false;
+    }
+    *tab = '\0';
+
+    *name = tab + 1;
+    tab = strchr(*name, '\t');
+    if (tab == NULL) {
+        return false;
+    }
+    *tab = '\0';
+
+    *duration = strtod(tab + 1, &endptr);
+    return endptr != tab + 1 && (*endptr == '\n' || *endptr == '\0');
+}
+
+static void __limpet_read_history(const char *path) {
+    FILE *fp;
+    char *line;
+    size_t line_size;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        if (errno != ENOENT) {
+            __limpet_warn("Unable to open history file %s: %s\n", path,
+                strerror(errno));
+        }
+        return;
+    }
+
+    line = NULL;
+    line_size = 0;
+
+    while (getline(&line, &line_size, fp) != -1) {
+        struct __limpet_test *test;
+        char *binary;
+        char *name;
+        double duration;
+
+        if (!__limpet_split_history(line, &binary, &name, &duration) ||
+            strcmp(binary, __limpet_binary_name()) != 0) {
+            continue;
+        }
+
+        test = __limpet_find_test(name);
+        if (test != NULL) {
+            test->expected_duration = duration;
+        }
+    }
+
+    free(line);
+    fclose(fp);
+}
+
+static void __limpet_write_history(const char *path) {
+    struct __limpet_test *p;
+    char *tmp_path;
+    size_t tmp_path_size;
+    FILE *in;
+    FILE *out;
+
+    tmp_path_size = strlen(path) + sizeof(".tmp.") + 3 * sizeof(pid_t);
+    tmp_path = (char *)malloc(tmp_path_size);
+    if (tmp_path == NULL) {
+        __limpet_fail("Out of memory allocating %zu bytes\n", tmp_path_size);
+    }
+    snprintf(tmp_path, tmp_path_size, "%s.tmp.%d", path, (int)getpid());
+
+    out = fopen(tmp_path, "w");
+    if (out == NULL) {
+        __limpet_warn("Unable to create history file %s: %s\n", tmp_path,
+            strerror(errno));
+        free(tmp_path);
+        return;
+    }
+
+    /*
+     * Keep the history for other test executables
+     */
+    in = fopen(path, "r");
+    if (in != NULL) {
+        char *line;
+        size_t line_size;
+
+        line = NULL;
+        line_size = 0;
+
+        while (getline(&line, &line_size, in) != -1) {
+            char *binary;
+            char *name;
+            double duration;
+
+            if (__limpet_split_history(line, &binary, &name, &duration) &&
+                strcmp(binary, __limpet_binary_name()) != 0) {
+                fprintf(out, "%s\t%s\t%.9g\n", binary, name, duration);
+            }
+        }
+
+        free(line);
+        fclose(in);
+    }
+
+    /*
+     * Tests that weren't run this time keep the duration from last time
+     */
+    for (p = __limpet_first_test(); p != NULL; p = __limpet_next_test(p)) {
+        double duration;
+
+        duration = p->skipped ? p->expected_duration : p->duration;
+        if (duration >= 0) {
+            fprintf(out, "%s\t%s\t%.9g\n", __limpet_binary_name(), p->name,
+                duration);
+        }
+    }
+
+    if (fclose(out) != 0 || rename(tmp_path, path) == -1) {
+        __limpet_warn("Unable to write history file %s: %s\n", path,
+            strerror(errno));
+        unlink(tmp_path);
+    }
+
+    free(tmp_path);
+}
+
+/*
+ * Called by dl_iterate_phdr() for each loaded object, the first of which
+ * is the executable, to look for its GNU build ID note. This is written
+ * in hex to data.
+ *
+ * Returns: non-zero, to stop after the executable
+ */
+static int __limpet_find_build_id(struct dl_phdr_info *info, size_t size,
+    void *data) {
+    char *build_id = (char *)data;
+    size_t i;
+
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        const char *note;
+        const char *end;
+        size_t align;
+
+        if (phdr->p_type != PT_NOTE) {
+            continue;
+        }
+
+        note = (const char *)(info->dlpi_addr + phdr->p_vaddr);
+        end = note + phdr->p_memsz;
+        align = phdr->p_align >= 8 ? 8 : 4;
+
+        while (note + sizeof(ElfW(Nhdr)) <= end) {
+            const ElfW(Nhdr) *nhdr = (const ElfW(Nhdr) *)note;
+            const char *name = note + sizeof(*nhdr);
+            const unsigned char *desc = (const unsigned char *)name +
+                ((nhdr->n_namesz + align - 1) & ~(align - 1));
+
+            if (nhdr->n_type == NT_GNU_BUILD_ID &&
+                nhdr->n_namesz == sizeof("GNU") &&
+                memcmp(name, "GNU", sizeof("GNU")) == 0 &&
+                nhdr->n_descsz <= __LIMPET_BUILD_ID_MAX) {
+                size_t j;
+
+                for (j = 0; j < nhdr->n_descsz; j++) {
+                    sprintf(build_id + 2 * j, "%02x", desc[j]);
+                }
+                return 1;
+            }
+
+            note = (const char *)desc +
+                ((nhdr->n_descsz + align - 1) & ~(align - 1));
+        }
+    }
+
+    return 1;
+}
+
+static const char *__limpet_build_id(void) {
+    static char build_id[2 * __LIMPET_BUILD_ID_MAX + 1];
+
+    if (build_id[0] == '\0') {
+        dl_iterate_phdr(__limpet_find_build_id, build_id);
+    }
+
+    /*
+     * Without a build ID, the size and modification time of the executable
+     * are the best way we have of telling one build from another
+     */
+    if (build_id[0] == '\0') {
+        struct stat st;
+
+        if (stat(__limpet_binary_name(), &st) == 0) {
+            snprintf(build_id, sizeof(build_id), "%llx-%llx",
+                (unsigned long long)st.st_size,
+                (unsigned long long)st.st_mtime);
+        } else {
+            strcpy(build_id, "unknown");
+        }
+    }
+
+    return build_id;
+}
+
+/*
+ * Split a benchmark history file line of the form:
+ *      <binary><tab><build ID><tab><test name><tab><iterations><tab>
+ *      <samples><tab><mean><tab><median><tab><min><tab><max><tab><mad>
+ *      <newline>
+ * into its fields. Times are in nanoseconds per iteration. The tabs after
+ * the binary, build ID and test name are overwritten.
+ *
+ * Returns: true if the line was valid, false otherwise
+ */
+static bool __limpet_split_bench_history(char *line, char **binary,
+    char **build_id, char **name, struct __limpet_bench_result *bench) {
+    char **fields[] = {binary, build_id, name};
+    size_t i;
+
+    for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        char *tab;
+
+        *fields[i] = line;
+        tab = strchr(line, '\t');
+        if (tab == NULL) {
+            return false;
+        }
+        *tab = '\0';
+        line = tab + 1;
+    }
+
+    memset(bench, 0, sizeof(*bench));
+    return sscanf(line, "%llu %u %lf %lf %lf %lf %lf", &bench->iterations,
+        &bench->samples, &bench->mean, &bench->median, &bench->min,
+        &bench->max, &bench->mad) == 7 && bench->iterations != 0;
+}
+
+static void __limpet_read_bench_history(const char *path,
+    const char *baseline) {
+    FILE *fp;
+    char *line;
+    size_t line_size;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        if (errno != ENOENT) {
+            __limpet_warn("Unable to open benchmark history file %s: %s\n",
+                path, strerror(errno));
+        }
+        return;
+    }
+
+    line = NULL;
+    line_size = 0;
+
+    while (getline(&line, &line_size, fp) != -1) {
+        struct __limpet_bench_result bench;
+        struct __limpet_test *test;
+        char *binary;
+        char *build_id;
+        char *name;
+
+        if (!__limpet_split_bench_history(line, &binary, &build_id, &name,
+            &bench)) {
+            continue;
+        }
+
+        /*
+         * A build ID given as the baseline is enough to identify the
+         * executable. Otherwise, the last results from another build of
+         * this executable are used. Results from this build are only
+         * repeats of this run.
+         */
+        if (baseline != NULL ? strcmp(build_id, baseline) != 0 :
+            strcmp(binary, __limpet_binary_name()) != 0 ||
+            strcmp(build_id, __limpet_build_id()) == 0) {
+            continue;
+        }
+
+        test = __limpet_find_test(name);
+        if (test == NULL) {
+            continue;
+        }
+
+        if (test->baseline == NULL) {
+            test->baseline = (struct __limpet_bench_baseline *)
+                calloc(1, sizeof(*test->baseline));
+            if (test->baseline == NULL) {
+                __limpet_fail("Out of memory allocating baseline\n");
+            }
+        }
+
+        free(test->baseline->build_id);
+        test->baseline->build_id = strdup(build_id);
+        if (test->baseline->build_id == NULL) {
+            __limpet_fail("Out of memory copying build ID\n");
+        }
+        test->baseline->bench = bench;
+    }
+
+    free(line);
+    fclose(fp);
+}
+
+/*
+ * Append the results of the benchmarks that were run. Each run appends
+ * to the file rather than rewriting it, so that results from every build
+ * are kept.
+ */
+static void __limpet_write_bench_history(const char *path) {
+    struct __limpet_test *p;
+    FILE *fp;
+
+    fp = fopen(path, "a");
+    if (fp == NULL) {
+        __limpet_warn("Unable to open benchmark history file %s: %s\n",
+            path, strerror(errno));
+        return;
+    }
+
+    for (p = __limpet_first_test(); p != NULL; p = __limpet_next_test(p)) {
+        const struct __limpet_bench_result *bench;
+
+        if (p->skipped || p->results == NULL ||
+            p->results->bench.iterations == 0) {
+            continue;
+        }
+
+        bench = &p->results->bench;
+        fprintf(fp, "%s\t%s\t%s\t%llu\t%u\t%.9g\t%.9g\t%.9g\t%.9g\t%.9g\n",
+            __limpet_binary_name(), __limpet_build_id(), p->name,
+            bench->iterations, bench->samples, bench->mean, bench->median,
+            bench->min, bench->max, bench->mad);
+    }
+
+    if (fclose(fp) != 0) {
+        __limpet_warn("Unable to write benchmark history file %s: %s\n",
+            path, strerror(errno));
+    }
+}
+
+/*
+ * Returns: true if the completed test passed, false otherwise
+ */
+static bool __limpet_test_passed(struct __limpet_test *test) {
+    int status = test->sysdep.exit_status;
+
+    return !test->sysdep.timedout && WIFEXITED(status) &&
+        WEXITSTATUS(status) == 0;
+}
+
+static double __limpet_timeval_seconds(const struct timeval *tv) {
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/*
+ * Get the resources used since start was filled in by getrusage() with
+ * the same who. The maximum resident set size can't be split up, so it is
+ * the current one.
+ */
+static void __limpet_rusage_since(int who, const struct rusage *start,
+    struct rusage *usage) {
+    if (getrusage(who, usage) == -1) {
+        __limpet_fail_errno("getrusage failed");
+    }
+
+    timersub(&usage->ru_utime, &start->ru_utime, &usage->ru_utime);
+    timersub(&usage->ru_stime, &start->ru_stime, &usage->ru_stime);
+    usage->ru_majflt -= start->ru_majflt;
+    usage->ru_minflt -= start->ru_minflt;
+    usage->ru_nvcsw -= start->ru_nvcsw;
+    usage->ru_nivcsw -= start->ru_nivcsw;
+}
+
+/*
+ * Make fd the standard input, output and error of this process, for a
+ * test run in the process running the tests. The old ones are kept in
+ * saved, to be put back by __limpet_restore_std_fds(), and the first time,
+ * in __limpet_std_dups too, for other threads to print to meanwhile.
+ */
+static void __limpet_redirect_std_fds(int fd, int saved[3])
+    __LIMPET_UNUSED;
+static void __limpet_redirect_std_fds(int fd, int saved[3]) {
+    int i;
+
+    fflush(stdout);
+    fflush(stderr);
+
+    for (i = 0; i < 3; i++) {
+        saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+        if (saved[i] == -1 && errno != EBADF) {
+            __limpet_fail_errno("Unable to save file descriptor %d", i);
+        }
+
+        if (__limpet_std_dups[i] == -1 && saved[i] != -1) {
+            __limpet_std_dups[i] = fcntl(saved[i], F_DUPFD_CLOEXEC, 3);
+        }
+    }
+
+    __atomic_store_n(&__limpet_std_redirected, true, __ATOMIC_RELEASE);
+    for (i = 0; i < 3; i++) {
+        if (dup2(fd, i) == -1) {
+            __limpet_fail_errno("dup2(%d, %d)", fd, i);
+        }
+    }
+}
+
+static void __limpet_restore_std_fds(int saved[3]) __LIMPET_UNUSED;
+static void __limpet_restore_std_fds(int saved[3]) {
+    int i;
+
+    fflush(stdout);
+    fflush(stderr);
+
+    for (i = 0; i < 3; i++) {
+        if (saved[i] == -1) {
+            (void)close(i);
+            continue;
+        }
+
+        if (dup2(saved[i], i) == -1) {
+            __limpet_fail_errno("dup2(%d, %d)", saved[i], i);
+        }
+
+        if (close(saved[i]) == -1) {
+            __limpet_fail_errno("close(%d)", saved[i]);
+        }
+    }
+    __atomic_store_n(&__limpet_std_redirected, false, __ATOMIC_RELEASE);
+}
+
+static void __limpet_print_resources(struct __limpet_test *test) {
+    const struct rusage *ru = &test->sysdep.rusage;
+
+    __limpet_printf("wall=%.3fs user=%.3fs sys=%.3fs maxrss=%ldKiB "
+        "majflt=%ld minflt=%ld nvcsw=%ld nivcsw=%ld", test->duration,
+        __limpet_timeval_seconds(&ru->ru_utime),
+        __limpet_timeval_seconds(&ru->ru_stime), ru->ru_maxrss,
+        ru->ru_majflt, ru->ru_minflt, ru->ru_nvcsw, ru->ru_nivcsw);
+}
+
+/*
+ * Write a tab-separated line for each test that was run, preceded by a
+ * header line naming the columns. Times are in seconds and maxrss is in
+ * kibibytes.
+ */
+static void __limpet_write_resources(const char *path) {
+    struct __limpet_test *p;
+    FILE *fp;
+
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        __limpet_warn("Unable to create resources file %s: %s\n", path,
+            strerror(errno));
+        return;
+    }
+
+    fprintf(fp, "test\tstatus\twall\tuser\tsys\tmaxrss\tmajflt\tminflt\t"
+        "nvcsw\tnivcsw\n");
+
+    for (p = __limpet_first_test(); p != NULL; p = __limpet_next_test(p)) {
+        const struct rusage *ru = &p->sysdep.rusage;
+
+        if (p->skipped) {
+            continue;
+        }
+
+        fprintf(fp, "%s\t%s\t%.6f\t%.6f\t%.6f\t%ld\t%ld\t%ld\t%ld\t%ld\n",
+            p->name, __limpet_test_passed(p) ? "pass" : "fail", p->duration,
+            __limpet_timeval_seconds(&ru->ru_utime),
+            __limpet_timeval_seconds(&ru->ru_stime), ru->ru_maxrss,
+            ru->ru_majflt, ru->ru_minflt, ru->ru_nvcsw, ru->ru_nivcsw);
+    }
+
+    if (fclose(fp) != 0) {
+        __limpet_warn("Unable to write resources file %s: %s\n", path,
+            strerror(errno));
+    }
+}
 #endif /* _LIMPET_POSIX_H_ */
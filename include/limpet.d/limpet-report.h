@@ -0,0 +1,552 @@
+/*
+ * Machine-readable reports of test results for POSIX-like operating
+ * systems. Each record is written and flushed as soon as its test has been
+ * reported, so the reports can be followed while tests are still running.
+ * The formats are:
+ *  json    JSON Lines, one object per test
+ *  tap     Test Anything Protocol version 13, with a YAML block per test
+ *  junit   JUnit XML
+ */
+
+#ifndef _LIMPET_REPORT_H_
+#define _LIMPET_REPORT_H_
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct __limpet_reporter;
+
+/*
+ * A report being written
+ * reporter - how to write the report's format
+ * fp - the file being written
+ * path - the name of the file
+ * n_tests - number of tests written so far
+ */
+struct __limpet_report {
+    const struct __limpet_reporter  *reporter;
+    FILE                            *fp;
+    const char                      *path;
+    unsigned                        n_tests;
+};
+
+/*
+ * Functions that write one format of report
+ * name - name of the format in LIMPET_REPORT
+ * begin - write whatever comes before the first test
+ * test - write the record for a test that completed or was skipped
+ * end - write whatever comes after the last test
+ */
+struct __limpet_reporter {
+    const char  *name;
+    void        (*begin)(struct __limpet_report *report);
+    void        (*test)(struct __limpet_report *report,
+        struct __limpet_test *test);
+    void        (*end)(struct __limpet_report *report);
+};
+
+/*
+ * The reports given in LIMPET_REPORT. These are only used by the thread
+ * running __limpet_run(), so no mutual exclusion is needed.
+ */
+struct __limpet_report *__limpet_reports __attribute((common));
+size_t __limpet_n_reports __attribute((common));
+
+static void __limpet_fprint_json_string(FILE *fp, const char *s,
+    size_t len) {
+    const char *end;
+    const char *p;
+
+    fputc('"', fp);
+
+    end = s + len;
+    while (s != end) {
+        unsigned char c;
+
+        /*
+         * Write characters that need no escaping all at once
+         */
+        for (p = s; p != end && *p != '"' && *p != '\\' &&
+            (unsigned char)*p >= 0x20; p++) {
+        }
+        fwrite(s, 1, p - s, fp);
+
+        if (p == end) {
+            break;
+        }
+
+        c = (unsigned char)*p;
+        if (c == '"' || c == '\\') {
+            fprintf(fp, "\\%c", c);
+        } else {
+            fprintf(fp, "\\u%04x", c);
+        }
+        s = p + 1;
+    }
+
+    fputc('"', fp);
+}
+
+/*
+ * Write a string that will be enclosed in double quotes in an XML file
+ */
+static void __limpet_fprint_xml_string(FILE *fp, const char *s) {
+    for (; *s != '\0'; s++) {
+        switch (*s) {
+        case '&':
+            fputs("&amp;", fp);
+            break;
+
+        case '<':
+            fputs("&lt;", fp);
+            break;
+
+        case '>':
+            fputs("&gt;", fp);
+            break;
+
+        case '"':
+            fputs("&quot;", fp);
+            break;
+
+        default:
+            fputc(*s, fp);
+            break;
+        }
+    }
+}
+
+/*
+ * Returns: true if the test is a benchmark that produced results
+ */
+static bool __limpet_is_bench(struct __limpet_test *test) {
+    return test->results != NULL && test->results->bench.iterations != 0;
+}
+
+/*
+ * Returns: true if any performance counters were read for the test
+ */
+static bool __limpet_has_perf(struct __limpet_test *test) {
+    size_t i;
+
+    if (!test->params->perf || test->results == NULL) {
+        return false;
+    }
+
+    for (i = 0; i < __LIMPET_PERF_COUNTERS; i++) {
+        if (test->results->perf.counted[i]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Returns: "pass", "fail" or "skip"
+ */
+static const char *__limpet_result_name(struct __limpet_test *test) {
+    if (test->skipped) {
+        return "skip";
+    }
+
+    return __limpet_test_passed(test) ? "pass" : "fail";
+}
+
+/*
+ * Describe how a test that was run ended, in the same terms as
+ * __limpet_print_status()
+ */
+static void __limpet_result_message(struct __limpet_test *test, char *buf,
+    size_t size) {
+    int status = test->sysdep.exit_status;
+
+    if (test->sysdep.timedout) {
+        snprintf(buf, size, "timed out after %g seconds",
+            test->params->timeout);
+    } else if (WIFEXITED(status)) {
+        snprintf(buf, size, "exit code %d", WEXITSTATUS(status));
+    } else if (WIFSIGNALED(status)) {
+        const char *name;
+        const char *core_dumped;
+        const char *exceeded;
+
+        name = __limpet_signame(WTERMSIG(status));
+#ifdef WCOREDUMP
+        core_dumped = WCOREDUMP(status) ? " (core dumped)" : "";
+#else
+        core_dumped = "";
+#endif
+        exceeded = __limpet_rlimit_exceeded(status);
+        snprintf(buf, size, "%s%s%ssignal SIG%s (%d)%s",
+            exceeded == NULL ? "" : "resource limit exceeded (",
+            exceeded == NULL ? "" : exceeded,
+            exceeded == NULL ? "" : "), ",
+            name == NULL ? "unknown" : name, WTERMSIG(status), core_dumped);
+    } else {
+        snprintf(buf, size, "unknown reason");
+    }
+}
+
+static void __limpet_json_begin(struct __limpet_report *report) {
+}
+
+static void __limpet_json_test(struct __limpet_report *report,
+    struct __limpet_test *test) {
+    const struct rusage *ru = &test->sysdep.rusage;
+    int status = test->sysdep.exit_status;
+    FILE *fp = report->fp;
+
+    fputs("{\"name\":", fp);
+    __limpet_fprint_json_string(fp, test->name, strlen(test->name));
+    fputs(",\"file\":", fp);
+    __limpet_fprint_json_string(fp, test->file, strlen(test->file));
+    fprintf(fp, ",\"line\":%u,\"status\":\"%s\"", test->line,
+        __limpet_result_name(test));
+
+    if (!test->skipped) {
+        char message[80];
+
+        __limpet_result_message(test, message, sizeof(message));
+        fputs(",\"message\":", fp);
+        __limpet_fprint_json_string(fp, message, strlen(message));
+
+        if (WIFEXITED(status)) {
+            fprintf(fp, ",\"exit_code\":%d,\"signal\":null",
+                WEXITSTATUS(status));
+        } else if (WIFSIGNALED(status)) {
+            fprintf(fp, ",\"exit_code\":null,\"signal\":%d",
+                WTERMSIG(status));
+        } else {
+            fputs(",\"exit_code\":null,\"signal\":null", fp);
+        }
+
+        fprintf(fp, ",\"timed_out\":%s,\"duration\":%.6f,\"user\":%.6f,"
+            "\"sys\":%.6f,\"maxrss_kib\":%ld,\"majflt\":%ld,\"minflt\":%ld,"
+            "\"nvcsw\":%ld,\"nivcsw\":%ld",
+            test->sysdep.timedout ? "true" : "false", test->duration,
+            __limpet_timeval_seconds(&ru->ru_utime),
+            __limpet_timeval_seconds(&ru->ru_stime), ru->ru_maxrss,
+            ru->ru_majflt, ru->ru_minflt, ru->ru_nvcsw, ru->ru_nivcsw);
+
+        if (__limpet_is_bench(test)) {
+            const struct __limpet_bench_result *bench =
+                &test->results->bench;
+
+            fprintf(fp, ",\"bench\":{\"iterations\":%llu,\"samples\":%u,"
+                "\"mean_ns\":%.6g,\"median_ns\":%.6g,\"min_ns\":%.6g,"
+                "\"max_ns\":%.6g,\"mad_ns\":%.6g}", bench->iterations,
+                bench->samples, bench->mean, bench->median, bench->min,
+                bench->max, bench->mad);
+        }
+
+        if (__limpet_has_perf(test)) {
+            const struct __limpet_perf_result *perf = &test->results->perf;
+            const char *sep;
+            size_t i;
+
+            fputs(",\"perf\":{", fp);
+            sep = "";
+            for (i = 0; i < __LIMPET_PERF_COUNTERS; i++) {
+                if (perf->counted[i]) {
+                    fprintf(fp, "%s\"%s\":%llu", sep, __limpet_perf_names[i],
+                        perf->values[i]);
+                    sep = ",";
+                }
+            }
+            fputs("}", fp);
+        }
+    }
+
+    fputs("}\n", fp);
+}
+
+static void __limpet_json_end(struct __limpet_report *report) {
+}
+
+static void __limpet_tap_begin(struct __limpet_report *report) {
+    fputs("TAP version 13\n", report->fp);
+}
+
+/*
+ * The plan goes at the end, since the number of tests isn't known until
+ * they have all been run
+ */
+static void __limpet_tap_test(struct __limpet_report *report,
+    struct __limpet_test *test) {
+    const struct rusage *ru = &test->sysdep.rusage;
+    FILE *fp = report->fp;
+    char message[80];
+
+    if (test->skipped) {
+        fprintf(fp, "ok %u - %s # SKIP not in runlist\n", report->n_tests,
+            test->name);
+        return;
+    }
+
+    __limpet_result_message(test, message, sizeof(message));
+    fprintf(fp, "%s %u - %s\n", __limpet_test_passed(test) ? "ok" : "not ok",
+        report->n_tests, test->name);
+    fputs("  ---\n  message: ", fp);
+    __limpet_fprint_json_string(fp, message, strlen(message));
+    fprintf(fp, "\n  timed_out: %s\n  duration: %.6f\n  user: %.6f\n"
+        "  sys: %.6f\n  maxrss_kib: %ld\n  majflt: %ld\n  minflt: %ld\n"
+        "  nvcsw: %ld\n  nivcsw: %ld\n",
+        test->sysdep.timedout ? "true" : "false", test->duration,
+        __limpet_timeval_seconds(&ru->ru_utime),
+        __limpet_timeval_seconds(&ru->ru_stime), ru->ru_maxrss,
+        ru->ru_majflt, ru->ru_minflt, ru->ru_nvcsw, ru->ru_nivcsw);
+
+    if (__limpet_is_bench(test)) {
+        const struct __limpet_bench_result *bench = &test->results->bench;
+
+        fprintf(fp, "  bench:\n    iterations: %llu\n    samples: %u\n"
+            "    mean_ns: %.6g\n    median_ns: %.6g\n    min_ns: %.6g\n"
+            "    max_ns: %.6g\n    mad_ns: %.6g\n", bench->iterations,
+            bench->samples, bench->mean, bench->median, bench->min,
+            bench->max, bench->mad);
+    }
+
+    if (__limpet_has_perf(test)) {
+        const struct __limpet_perf_result *perf = &test->results->perf;
+        size_t i;
+
+        fputs("  perf:\n", fp);
+        for (i = 0; i < __LIMPET_PERF_COUNTERS; i++) {
+            if (perf->counted[i]) {
+                fprintf(fp, "    %s: %llu\n", __limpet_perf_names[i],
+                    perf->values[i]);
+            }
+        }
+    }
+
+    fputs("  ...\n", fp);
+}
+
+static void __limpet_tap_end(struct __limpet_report *report) {
+    fprintf(report->fp, "1..%u\n", report->n_tests);
+}
+
+/*
+ * The counts usually given as attributes of <testsuite> aren't known until
+ * the end, so they are left out. JUnit consumers count the <testcase>
+ * elements instead.
+ */
+static void __limpet_junit_begin(struct __limpet_report *report) {
+    FILE *fp = report->fp;
+
+    fputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<testsuites>\n"
+        "  <testsuite name=\"", fp);
+    __limpet_fprint_xml_string(fp, __limpet_binary_name());
+    fputs("\">\n", fp);
+}
+
+static void __limpet_junit_test(struct __limpet_report *report,
+    struct __limpet_test *test) {
+    const struct rusage *ru = &test->sysdep.rusage;
+    FILE *fp = report->fp;
+
+    fputs("    <testcase name=\"", fp);
+    __limpet_fprint_xml_string(fp, test->name);
+    fputs("\" classname=\"", fp);
+    __limpet_fprint_xml_string(fp, __limpet_binary_name());
+    fputs("\" file=\"", fp);
+    __limpet_fprint_xml_string(fp, test->file);
+    fprintf(fp, "\" line=\"%u\" time=\"%.6f\">\n", test->line,
+        test->skipped ? 0.0 : test->duration);
+
+    if (test->skipped) {
+        fputs("      <skipped message=\"not in runlist\"/>\n", fp);
+    } else {
+        if (!__limpet_test_passed(test)) {
+            char message[80];
+
+            __limpet_result_message(test, message, sizeof(message));
+            fprintf(fp, "      <failure type=\"%s\" message=\"",
+                test->sysdep.timedout ? "timeout" :
+                WIFSIGNALED(test->sysdep.exit_status) ? "signal" : "exit");
+            __limpet_fprint_xml_string(fp, message);
+            fputs("\"/>\n", fp);
+        }
+
+        fprintf(fp, "      <properties>\n"
+            "        <property name=\"user\" value=\"%.6f\"/>\n"
+            "        <property name=\"sys\" value=\"%.6f\"/>\n"
+            "        <property name=\"maxrss_kib\" value=\"%ld\"/>\n"
+            "        <property name=\"majflt\" value=\"%ld\"/>\n"
+            "        <property name=\"minflt\" value=\"%ld\"/>\n"
+            "        <property name=\"nvcsw\" value=\"%ld\"/>\n"
+            "        <property name=\"nivcsw\" value=\"%ld\"/>\n",
+            __limpet_timeval_seconds(&ru->ru_utime),
+            __limpet_timeval_seconds(&ru->ru_stime), ru->ru_maxrss,
+            ru->ru_majflt, ru->ru_minflt, ru->ru_nvcsw, ru->ru_nivcsw);
+
+        if (__limpet_is_bench(test)) {
+            const struct __limpet_bench_result *bench =
+                &test->results->bench;
+
+            fprintf(fp,
+                "        <property name=\"bench_iterations\" "
+                "value=\"%llu\"/>\n"
+                "        <property name=\"bench_samples\" value=\"%u\"/>\n"
+                "        <property name=\"bench_mean_ns\" "
+                "value=\"%.6g\"/>\n"
+                "        <property name=\"bench_median_ns\" "
+                "value=\"%.6g\"/>\n"
+                "        <property name=\"bench_min_ns\" value=\"%.6g\"/>\n"
+                "        <property name=\"bench_max_ns\" value=\"%.6g\"/>\n"
+                "        <property name=\"bench_mad_ns\" "
+                "value=\"%.6g\"/>\n",
+                bench->iterations, bench->samples, bench->mean,
+                bench->median, bench->min, bench->max, bench->mad);
+        }
+
+        if (__limpet_has_perf(test)) {
+            const struct __limpet_perf_result *perf = &test->results->perf;
+            size_t i;
+
+            for (i = 0; i < __LIMPET_PERF_COUNTERS; i++) {
+                if (perf->counted[i]) {
+                    fprintf(fp, "        <property name=\"perf_%s\" "
+                        "value=\"%llu\"/>\n", __limpet_perf_names[i],
+                        perf->values[i]);
+                }
+            }
+        }
+
+        fputs("      </properties>\n", fp);
+    }
+
+    fputs("    </testcase>\n", fp);
+}
+
+static void __limpet_junit_end(struct __limpet_report *report) {
+    fputs("  </testsuite>\n</testsuites>\n", report->fp);
+}
+
+static const struct __limpet_reporter __limpet_reporters[] = {
+    {
+        .name = "json",
+        .begin = __limpet_json_begin,
+        .test = __limpet_json_test,
+        .end = __limpet_json_end,
+    },
+    {
+        .name = "tap",
+        .begin = __limpet_tap_begin,
+        .test = __limpet_tap_test,
+        .end = __limpet_tap_end,
+    },
+    {
+        .name = "junit",
+        .begin = __limpet_junit_begin,
+        .test = __limpet_junit_test,
+        .end = __limpet_junit_end,
+    },
+};
+
+/*
+ * Write whatever has been buffered for a report. This is done after each
+ * record so that the reports can be followed while tests run, and so
+ * that test processes forked later don't inherit buffered data that they
+ * would write again when they exit.
+ */
+static void __limpet_flush_report(struct __limpet_report *report) {
+    if (fflush(report->fp) != 0) {
+        __limpet_warn("Unable to write report %s: %s\n", report->path,
+            strerror(errno));
+    }
+}
+
+static void __limpet_open_reports(const char *spec) {
+    char *entries;
+    char *entry;
+    char *saveptr;
+    size_t n;
+
+    /*
+     * The paths point into a copy of the specification, which is kept for
+     * as long as we run
+     */
+    entries = strdup(spec);
+    if (entries == NULL) {
+        __limpet_fail("Out of memory copying report list\n");
+    }
+
+    n = 1;
+    for (entry = strchr(entries, ' '); entry != NULL;
+        entry = strchr(entry + 1, ' ')) {
+        n++;
+    }
+
+    __limpet_reports = (struct __limpet_report *)calloc(n,
+        sizeof(__limpet_reports[0]));
+    if (__limpet_reports == NULL) {
+        __limpet_fail("Out of memory allocating %zu reports\n", n);
+    }
+
+    for (entry = strtok_r(entries, " ", &saveptr); entry != NULL;
+        entry = strtok_r(NULL, " ", &saveptr)) {
+        struct __limpet_report *report;
+        char *colon;
+        size_t i;
+
+        colon = strchr(entry, ':');
+        if (colon == NULL || colon[1] == '\0') {
+            __limpet_fail("REPORT entries must look like format:file\n");
+        }
+        *colon = '\0';
+
+        for (i = 0; i < __LIMPET_ARRAY_SIZE(__limpet_reporters); i++) {
+            if (strcmp(entry, __limpet_reporters[i].name) == 0) {
+                break;
+            }
+        }
+        if (i == __LIMPET_ARRAY_SIZE(__limpet_reporters)) {
+            __limpet_fail("REPORT format must be json, tap or junit\n");
+        }
+
+        report = &__limpet_reports[__limpet_n_reports];
+        report->reporter = &__limpet_reporters[i];
+        report->path = colon + 1;
+        report->fp = fopen(report->path, "we");
+        if (report->fp == NULL) {
+            __limpet_fail_errno("Unable to create report %s", report->path);
+        }
+        __limpet_n_reports += 1;
+
+        report->reporter->begin(report);
+        __limpet_flush_report(report);
+    }
+}
+
+static void __limpet_report_test(struct __limpet_test *test) {
+    size_t i;
+
+    for (i = 0; i < __limpet_n_reports; i++) {
+        struct __limpet_report *report = &__limpet_reports[i];
+
+        report->n_tests += 1;
+        report->reporter->test(report, test);
+        __limpet_flush_report(report);
+    }
+}
+
+static void __limpet_close_reports(void) {
+    size_t i;
+
+    for (i = 0; i < __limpet_n_reports; i++) {
+        struct __limpet_report *report = &__limpet_reports[i];
+
+        report->reporter->end(report);
+        if (fclose(report->fp) != 0) {
+            __limpet_warn("Unable to write report %s: %s\n", report->path,
+                strerror(errno));
+        }
+    }
+}
+#endif /* _LIMPET_REPORT_H_ */
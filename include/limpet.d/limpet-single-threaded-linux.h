@@ -5,29 +5,44 @@
 #ifndef _LIMPET_SINGLE_THREADED_LINUX_H_
 #define _LIMPET_SINGLE_THREADED_LINUX_H_
 
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/select.h>
 #include <fcntl.h>
 
 /*
  * System-dependent definitions
  * pid - Process ID of forked process
+ * pid_fd - file descriptor referring to the process in pid
  * tty - output file descriptor for the child
  * timedout - true if the process timed out
  * exit_status - child's exit status
+ * rusage - resources used by the child
+ * perf_fds - file descriptor for each performance counter open on the
+ *      child, or NULL if they aren't being read
  */
 struct __limpet_sysdep {
     pid_t   pid;
+    int     pid_fd;
     int     tty;
     bool    timedout;
     int     exit_status;
+    struct rusage rusage;
+    int     *perf_fds;
 };
 
 #include "limpet.d/limpet-single-threaded.h"
+#include "limpet.d/limpet-spawn-linux.h"
+#include "limpet.d/limpet-perf-linux.h"
 
 #define __LIMPET_SYSDEP_INIT { \
         .pid = -1, \
+        .pid_fd = -1, \
         .tty = -1, \
         .timedout = false, \
         .exit_status = -1, \
+        .rusage = {}, \
+        .perf_fds = NULL, \
     }
 
 static void __limpet_exit(bool is_error) __attribute((noreturn));
@@ -36,78 +51,139 @@ static void __limpet_exit(bool is_error) {
 }
 
 /*
- * Wait for the process to terminate
+ * How to start tests. This is set with -DLIMPET_SPAWN=fork, clone3 or exec
  */
-static void __limpet_wait(struct __limpet_test *test) {
-    struct timeval timeout;
-    struct timeval abs_timeout;
-    struct timeval delta_timeout;
-    struct timeval now;
-    struct timeval *tv;
-    fd_set rfds;
-    int nfds;
-    int pid_fd;
-    int rc;
+static enum __limpet_spawn_strategy __limpet_spawn_strategy;
 
-    timeout.tv_sec = (time_t)test->params->timeout;
-    timeout.tv_usec = (suseconds_t)((test->params->timeout - timeout.tv_sec) *
-        1000000);
-    rc = gettimeofday(&abs_timeout, NULL);
-    if (rc == -1) {
-        __limpet_fail_errno("gettimeofday failed");
-    }
-    timeradd(&abs_timeout, &timeout, &abs_timeout);
+static void __limpet_parse_sysdep_params(void) {
+#ifdef LIMPET_SPAWN
+    __limpet_spawn_strategy =
+        __limpet_parse_spawn(__LIMPET_STRINGIFY(LIMPET_SPAWN));
+#else
+    __limpet_spawn_strategy = __limpet_parse_spawn(NULL);
+#endif
 
     /*
-     * Get a file descriptor for this pid so we can use select() to wait for
-     * it to exit
+     * Processes a test leaves behind when it exits are reparented to us,
+     * so that we can reap them while making sure its process group is gone
      */
-    pid_fd = syscall(SYS_pidfd_open, test->sysdep.pid, 0);
-    if (pid_fd == -1) {
-        __limpet_fail_errno("pidfd_open failed for pid %d",
-            test->sysdep.pid);
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1) == -1) {
+        __limpet_warn_errno("Unable to become a child subreaper");
     }
+}
 
-    nfds = 0;
+static bool __limpet_fixtures_inherited(void) {
+    return __limpet_spawn_strategy != __limpet_spawn_exec;
+}
 
-    FD_ZERO(&rfds);
+/*
+ * Interval at which to check whether what is left of a test's process
+ * group is gone
+ */
+#define __LIMPET_DRAIN_INTERVAL 0.001
 
-    FD_SET(pid_fd, &rfds);
-    nfds = MAX(nfds, pid_fd + 1);
+/*
+ * Wait for the test process to exit, or until the given number of seconds
+ * has passed
+ * seconds - how long to wait, or zero to wait forever
+ *
+ * Returns: true if the process exited, false if the time ran out
+ */
+static bool __limpet_wait_exit(struct __limpet_test *test, double seconds) {
+    struct timespec deadline;
+    struct timespec now;
+    struct timespec delta;
+    struct timespec *ts;
+    fd_set rfds;
+    int rc;
 
-    rc = gettimeofday(&now, NULL);
-    if (rc == -1) {
-        __limpet_fail("gettimeofday failed");
-    }
-    if (timercmp(&abs_timeout, &now, >)) {
-        timersub(&abs_timeout, &now, &delta_timeout);
-    } else {
-        timerclear(&delta_timeout);
+    if (seconds != 0) {
+        __limpet_deadline(seconds, &deadline);
     }
-    tv = &delta_timeout;
 
-    rc = select(nfds, &rfds, NULL, NULL, tv);
+    do {
+        ts = NULL;
+        if (seconds != 0) {
+            if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+                __limpet_fail_errno("clock_gettime failed");
+            }
+
+            delta.tv_sec = 0;
+            delta.tv_nsec = 0;
+            if (__limpet_timespec_before(&now, &deadline)) {
+                delta.tv_sec = deadline.tv_sec - now.tv_sec;
+                delta.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+                if (delta.tv_nsec < 0) {
+                    delta.tv_sec -= 1;
+                    delta.tv_nsec += 1000000000;
+                }
+            }
+            ts = &delta;
+        }
+
+        FD_ZERO(&rfds);
+        FD_SET(test->sysdep.pid_fd, &rfds);
+
+        rc = pselect(test->sysdep.pid_fd + 1, &rfds, NULL, NULL, ts, NULL);
+    } while (rc == -1 && errno == EINTR);
+
     if (rc == -1) {
-        __limpet_fail_errno("Select failed");
+        __limpet_fail_errno("pselect failed");
     }
 
-    if (rc == 0) {
+    return rc != 0;
+}
+
+/*
+ * Wait for the process to terminate. A test that runs too long is sent
+ * SIGTERM, along with its process group, then SIGKILL if it hasn't exited
+ * by the end of the grace period. Once the test has exited, anything it
+ * left running in its process group is killed, and whatever it left
+ * behind outside the group that has since exited is reaped.
+ */
+static void __limpet_wait(struct __limpet_test *test) {
+    struct timespec interval;
+    int rc;
+
+    /*
+     * A timeout of zero means the test can run forever
+     */
+    if (!__limpet_wait_exit(test, test->params->timeout)) {
         test->sysdep.timedout = true;
-        rc = kill(test->sysdep.pid, SIGKILL);
-        if (rc == -1) {
-            __limpet_warn("Unable to kill PID %d\n",
-                test->sysdep.pid);
+        if (test->params->kill_grace == 0) {
+            __limpet_signal_group(test->sysdep.pid, SIGKILL);
+        } else {
+            __limpet_signal_group(test->sysdep.pid, SIGTERM);
+            if (!__limpet_wait_exit(test, test->params->kill_grace)) {
+                __limpet_signal_group(test->sysdep.pid, SIGKILL);
+            }
         }
     }
 
-    rc = waitpid(test->sysdep.pid, &test->sysdep.exit_status, 0);
+    rc = wait4(test->sysdep.pid, &test->sysdep.exit_status, 0,
+        &test->sysdep.rusage);
     if (rc == -1) {
-        __limpet_fail_errno("waitpid failed");
+        __limpet_fail_errno("wait4 failed");
     }
+    test->duration = __limpet_now() - test->start_time;
+    __limpet_perf_read(test);
 
-    if (close(pid_fd) == -1) {
+    if (close(test->sysdep.pid_fd) == -1) {
         __limpet_fail_errno("close(pid_fd) failed");
     }
+    test->sysdep.pid_fd = -1;
+
+    interval.tv_sec = 0;
+    interval.tv_nsec = __LIMPET_DRAIN_INTERVAL * 1000000000;
+    while (!__limpet_kill_group(test->sysdep.pid)) {
+        nanosleep(&interval, NULL);
+    }
+
+    /*
+     * No other test is running, so reap whatever the tests have left
+     * behind outside their process groups
+     */
+    __limpet_reap_orphans(NULL);
 }
 
 /*
@@ -161,6 +237,24 @@ static void __limpet_setup_std_fds(struct __limpet_sysdep *sysdep) {
 }
     
 
+/*
+ * Count a test that has completed as passed or failed and hand it over for
+ * reporting
+ */
+static void __limpet_complete(struct __limpet_test *test) {
+    if (test->sysdep.timedout) {
+        __limpet_inc_failed();
+        __limpet_enqueue_done(test);
+    } else if (!WIFEXITED(test->sysdep.exit_status) ||
+        WEXITSTATUS(test->sysdep.exit_status) != 0) {
+            __limpet_inc_failed();
+            __limpet_enqueue_done(test);
+    } else {
+            __limpet_inc_passed();
+            __limpet_enqueue_done(test);
+    }
+}
+
 /*
  * Run the test as a subprocess
  */
@@ -173,16 +267,15 @@ static void __limpet_start_one(struct __limpet_test *test) {
         __limpet_fail_errno("fflush(stdout) failed");
     }
 
-    pid = fork();
-    switch (pid) {
-    case -1:
-        __limpet_fail_errno("Fork failed");
-        break;
+    __limpet_make_std_fd(&test->sysdep);
 
+    pid = __limpet_spawn(test, __limpet_spawn_strategy, test->sysdep.tty,
+        &test->sysdep.pid_fd);
+    switch (pid) {
     case 0:
-        __limpet_make_std_fd(&test->sysdep);
+        __limpet_new_process_group();
         __limpet_setup_std_fds(&test->sysdep);
-        (*test->func)();
+        __limpet_call_test(test);
         __limpet_exit(false);
         break;
 
@@ -190,23 +283,62 @@ static void __limpet_start_one(struct __limpet_test *test) {
         /*
          * Set the process ID and let the wait begin
          */
+        if (test->sysdep.tty != -1 && close(test->sysdep.tty) == -1) {
+            __limpet_fail_errno("close(tty %d)", test->sysdep.tty);
+        }
+        test->sysdep.tty = -1;
         test->sysdep.pid = pid;
         break;
     }
 
+    if (test->params->perf) {
+        __limpet_perf_attach(test);
+    }
+
     __limpet_wait(test);
+    __limpet_complete(test);
+}
 
-    if (test->sysdep.timedout) {
-        __limpet_inc_failed();
-        __limpet_enqueue_done(test);
-    } else if (!WIFEXITED(test->sysdep.exit_status) ||
-        WEXITSTATUS(test->sysdep.exit_status) != 0) {
-            __limpet_inc_failed();
-            __limpet_enqueue_done(test);
-    } else {
-            __limpet_inc_passed();
-            __limpet_enqueue_done(test);
+/*
+ * Run the test in this process. Its output goes wherever that of a test
+ * run as a subprocess would. A test run this way can't be timed out.
+ */
+static void __limpet_start_inproc(struct __limpet_test *test)
+    __LIMPET_UNUSED;
+static void __limpet_start_inproc(struct __limpet_test *test) {
+    struct rusage start;
+    int saved[3];
+    bool passed;
+
+    if (fflush(stdout) == -1) {
+        __limpet_fail_errno("fflush(stdout) failed");
     }
+
+    __limpet_make_std_fd(&test->sysdep);
+
+    if (getrusage(RUSAGE_SELF, &start) == -1) {
+        __limpet_fail_errno("getrusage failed");
+    }
+
+    if (test->sysdep.tty != -1) {
+        __limpet_redirect_std_fds(test->sysdep.tty, saved);
+    }
+
+    passed = __limpet_call_inproc(test);
+
+    if (test->sysdep.tty != -1) {
+        __limpet_restore_std_fds(saved);
+        if (close(test->sysdep.tty) == -1) {
+            __limpet_fail_errno("close(tty %d)", test->sysdep.tty);
+        }
+        test->sysdep.tty = -1;
+    }
+
+    __limpet_rusage_since(RUSAGE_SELF, &start, &test->sysdep.rusage);
+    test->duration = __limpet_now() - test->start_time;
+    test->sysdep.exit_status = W_EXITCODE(passed ? EXIT_SUCCESS :
+        EXIT_FAILURE, 0);
+    __limpet_complete(test);
 }
 
 static void __limpet_cleanup_test(struct __limpet_test *test) {
@@ -10,11 +10,13 @@
 #define _LIMPET_SINGLE_THREADED_H_
 
 #include <sys/param.h>
+#include <sys/resource.h>
 #include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/wait.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -26,9 +28,11 @@ static void __limpet_wait(struct __limpet_test *test);
 static void __limpet_start_one(struct __limpet_test *test);
 static void __limpet_start_one(struct __limpet_test *test);
 static void __limpet_cleanup_test(struct __limpet_test *test);
+static void __limpet_parse_sysdep_params(void);
 
 #include "limpet.d/limpet-sysdep.h"
 #include "limpet.d/limpet-posix.h"
+#include "limpet.d/limpet-report.h"
 
 #define __LIMPET_STRINGIFY_HELPER(token)    #token
 #define __LIMPET_STRINGIFY(token)           __LIMPET_STRINGIFY_HELPER(token)
@@ -85,6 +89,54 @@ static const char *__limpet_get_timeout(void) {
 #endif
 }
 
+static const char *__limpet_get_kill_grace(void) {
+#ifdef LIMPET_KILL_GRACE
+    return __LIMPET_STRINGIFY(LIMPET_KILL_GRACE);
+#else
+    return NULL;
+#endif
+}
+
+static const char *__limpet_get_bench_time(void) {
+#ifdef LIMPET_BENCH_TIME
+    return __LIMPET_STRINGIFY(LIMPET_BENCH_TIME);
+#else
+    return NULL;
+#endif
+}
+
+static const char *__limpet_get_bench_history(void) {
+#ifdef LIMPET_BENCH_HISTORY
+    return __LIMPET_STRINGIFY(LIMPET_BENCH_HISTORY);
+#else
+    return NULL;
+#endif
+}
+
+static const char *__limpet_get_bench_baseline(void) {
+#ifdef LIMPET_BENCH_BASELINE
+    return __LIMPET_STRINGIFY(LIMPET_BENCH_BASELINE);
+#else
+    return NULL;
+#endif
+}
+
+static const char *__limpet_get_bench_threshold(void) {
+#ifdef LIMPET_BENCH_THRESHOLD
+    return __LIMPET_STRINGIFY(LIMPET_BENCH_THRESHOLD);
+#else
+    return NULL;
+#endif
+}
+
+static const char *__limpet_get_bench_gate(void) {
+#ifdef LIMPET_BENCH_GATE
+    return __LIMPET_STRINGIFY(LIMPET_BENCH_GATE);
+#else
+    return NULL;
+#endif
+}
+
 static const char *__limpet_get_verbose(void) {
 #ifdef LIMPET_VERBOSE
     return __LIMPET_STRINGIFY(LIMPET_VERBOSE);
@@ -93,9 +145,92 @@ static const char *__limpet_get_verbose(void) {
 #endif
 }
 
+static const char *__limpet_get_history(void) {
+#ifdef LIMPET_HISTORY
+    return __LIMPET_STRINGIFY(LIMPET_HISTORY);
+#else
+    return NULL;
+#endif
+}
+
+static const char *__limpet_get_resources(void) {
+#ifdef LIMPET_RESOURCES
+    return __LIMPET_STRINGIFY(LIMPET_RESOURCES);
+#else
+    return NULL;
+#endif
+}
+
+static const char *__limpet_get_shard_index(void) {
+#ifdef LIMPET_SHARD_INDEX
+    return __LIMPET_STRINGIFY(LIMPET_SHARD_INDEX);
+#else
+    return NULL;
+#endif
+}
+
+static const char *__limpet_get_shard_count(void) {
+#ifdef LIMPET_SHARD_COUNT
+    return __LIMPET_STRINGIFY(LIMPET_SHARD_COUNT);
+#else
+    return NULL;
+#endif
+}
+
+static const char *__limpet_get_shard_by(void) {
+#ifdef LIMPET_SHARD_BY
+    return __LIMPET_STRINGIFY(LIMPET_SHARD_BY);
+#else
+    return NULL;
+#endif
+}
+
+static const char *__limpet_get_list(void) {
+#ifdef LIMPET_LIST
+    return __LIMPET_STRINGIFY(LIMPET_LIST);
+#else
+    return NULL;
+#endif
+}
+
+static const char *__limpet_get_report(void) {
+#ifdef LIMPET_REPORT
+    return __LIMPET_STRINGIFY(LIMPET_REPORT);
+#else
+    return NULL;
+#endif
+}
+
+static const char *__limpet_get_rlimits(void) {
+#ifdef LIMPET_RLIMITS
+    return __LIMPET_STRINGIFY(LIMPET_RLIMITS);
+#else
+    return NULL;
+#endif
+}
+
+static const char *__limpet_get_perf(void) {
+#ifdef LIMPET_PERF
+    return __LIMPET_STRINGIFY(LIMPET_PERF);
+#else
+    return NULL;
+#endif
+}
+
+static const char *__limpet_get_inproc(void) {
+#ifdef LIMPET_INPROC
+    return __LIMPET_STRINGIFY(LIMPET_INPROC);
+#else
+    return NULL;
+#endif
+}
+
 static void __limpet_parse_done() {
 }
 
+static void __limpet_sysdep_init(void) {
+}
+
 /*
  * We don't store the log, so nothing to do other than report we printed
  * the log.
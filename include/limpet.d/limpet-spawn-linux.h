@@ -0,0 +1,449 @@
+/*
+ * Creation of test processes, and reaping of what they leave behind,
+ * shared by the Linux versions of Limpet.
+ *
+ * There are three ways to start a test:
+ *  fork    Plain fork(). The pidfd has to be opened afterwards. This is
+ *          the default.
+ *  clone3  clone3() with CLONE_PIDFD, which gets the pidfd without a
+ *          second system call. If clone3() isn't available, clone() is
+ *          used instead and the pidfd is opened afterwards, just as for
+ *          fork(). Since neither goes through glibc, pthread_atfork()
+ *          handlers are not run and glibc doesn't reset its stdio and
+ *          malloc locks in the child. If another thread holds one of them
+ *          at the time, the test hangs as soon as it needs it, so this is
+ *          only safe if no other thread can be using stdio or malloc. The
+ *          Linux version runs a supervisor thread that does, so it clones
+ *          tests from the zygote, which has a single thread, instead.
+ *  exec    Run the test executable again, asking it to run just the one
+ *          test, in the style of posix_spawn(). Since the test starts with
+ *          fresh stdio buffers, output written just before the test dies
+ *          may show up in the log where it wouldn't with fork().
+ */
+
+#ifndef _LIMPET_SPAWN_LINUX_H_
+#define _LIMPET_SPAWN_LINUX_H_
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern char **environ;
+
+/*
+ * Environment variable used to tell a re-executed test executable which
+ * test to run
+ */
+#define __LIMPET_RUN_ONE    "LIMPET_RUN_ONE"
+
+/*
+ * Environment variable used to pass the resource limits for all tests to a
+ * re-executed test executable
+ */
+#define __LIMPET_RUN_RLIMITS "LIMPET_RUN_RLIMITS"
+
+/*
+ * Environment variable used to pass the file descriptor of the memory
+ * shared with the tests to a re-executed test executable
+ */
+#define __LIMPET_RUN_SHARED "LIMPET_RUN_SHARED"
+
+/*
+ * File descriptor for the memory shared with the tests, or -1
+ */
+static int __limpet_shared_fd = -1;
+
+/*
+ * Map size bytes of the file descriptor for shared memory
+ */
+static void *__limpet_map_shared_fd(int fd, size_t size) {
+    void *shared;
+
+    shared = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shared == MAP_FAILED) {
+        __limpet_fail_errno("Unable to map memory shared with tests");
+    }
+
+    return shared;
+}
+
+/*
+ * The memory is kept in a memfd rather than being an anonymous mapping so
+ * that it can be passed to tests started by the exec strategy
+ */
+static void *__limpet_map_shared(size_t size) {
+    __limpet_shared_fd = memfd_create("limpet-shared", MFD_CLOEXEC);
+    if (__limpet_shared_fd == -1) {
+        __limpet_fail_errno("Unable to create memory shared with tests");
+    }
+
+    if (ftruncate(__limpet_shared_fd, size) == -1) {
+        __limpet_fail_errno("Unable to size memory shared with tests");
+    }
+
+    return __limpet_map_shared_fd(__limpet_shared_fd, size);
+}
+
+enum __limpet_spawn_strategy {
+    __limpet_spawn_fork,
+    __limpet_spawn_clone3,
+    __limpet_spawn_exec,
+};
+
+/*
+ * The first version of the argument structure for clone3(). This is the
+ * same as struct clone_args in <linux/sched.h>, which can't be #included
+ * along with <sched.h>.
+ */
+struct __limpet_clone_args {
+    uint64_t    flags;
+    uint64_t    pidfd;
+    uint64_t    child_tid;
+    uint64_t    parent_tid;
+    uint64_t    exit_signal;
+    uint64_t    stack;
+    uint64_t    stack_size;
+    uint64_t    tls;
+};
+
+/*
+ * Convert the name of a strategy for starting tests
+ * value - The name, or NULL to get the default
+ */
+static enum __limpet_spawn_strategy __limpet_parse_spawn(const char *value) {
+    if (value == NULL || strcmp(value, "fork") == 0) {
+        return __limpet_spawn_fork;
+    }
+
+    if (strcmp(value, "clone3") == 0) {
+        return __limpet_spawn_clone3;
+    }
+
+    if (strcmp(value, "exec") != 0) {
+        __limpet_fail("SPAWN must be fork, clone3, or exec\n");
+    }
+
+    return __limpet_spawn_exec;
+}
+
+/*
+ * Like fork(), but with additional clone() flags. If possible, a pidfd
+ * is returned in *pid_fd, otherwise it is set to -1.
+ *
+ * Returns: the process ID in the parent, zero in the child, -1 on error
+ */
+static pid_t __limpet_clone(unsigned long flags, int *pid_fd) {
+    struct __limpet_clone_args args;
+    pid_t pid;
+
+    memset(&args, 0, sizeof(args));
+    args.flags = flags | CLONE_PIDFD;
+    args.pidfd = (uintptr_t)pid_fd;
+
+    /*
+     * With CLONE_PARENT, the child gets the exit signal of the caller and
+     * clone3() requires this to be zero
+     */
+    args.exit_signal = (flags & CLONE_PARENT) ? 0 : SIGCHLD;
+
+    *pid_fd = -1;
+    pid = syscall(SYS_clone3, &args, sizeof(args));
+
+    /*
+     * Older kernels don't have clone3() and some seccomp filters don't
+     * allow it
+     */
+    if (pid == -1 && (errno == ENOSYS || errno == EPERM)) {
+        pid = syscall(SYS_clone, flags | SIGCHLD, 0, NULL, NULL, 0);
+    }
+
+    return pid;
+}
+
+/*
+ * Running in the context of a test child process, put the test in a
+ * process group of its own, so that it can be killed along with anything
+ * it starts
+ */
+static void __limpet_new_process_group(void) {
+    if (setpgid(0, 0) == -1) {
+        __limpet_fail_errno("setpgid failed");
+    }
+}
+
+/*
+ * Reap processes that were reparented to us because we are a child
+ * subreaper and have since exited. These were left behind by tests, but
+ * put themselves outside the test's process group, such as by calling
+ * setsid(), so __limpet_kill_group() never sees them. Every test runs in a
+ * process group of its own, so children still in ours were started by code
+ * running in this process, such as an inproc test or a fixture, which may
+ * yet wait for them, and are left alone.
+ * is_test - returns true for a test that hasn't been reaped yet, which is
+ *      left alone too, or NULL if there is none
+ */
+static void __limpet_reap_orphans(bool (*is_test)(pid_t pid)) {
+    char path[64];
+    struct dirent *entry;
+    pid_t pgid;
+    DIR *dp;
+
+    dp = opendir("/proc/self/task");
+    if (dp == NULL) {
+        return;
+    }
+
+    pgid = getpgrp();
+    while ((entry = readdir(dp)) != NULL) {
+        siginfo_t info;
+        FILE *fp;
+        int child;
+
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "/proc/self/task/%d/children",
+            atoi(entry->d_name));
+        fp = fopen(path, "r");
+        if (fp == NULL) {
+            continue;
+        }
+
+        while (fscanf(fp, "%d", &child) == 1) {
+            if (getpgid(child) == pgid ||
+                (is_test != NULL && (*is_test)(child))) {
+                continue;
+            }
+
+            memset(&info, 0, sizeof(info));
+            if (waitid(P_PID, child, &info, WEXITED | WNOHANG) == -1 &&
+                errno != ECHILD) {
+                __limpet_warn_errno("Unable to reap process %d", child);
+            }
+        }
+
+        fclose(fp);
+    }
+
+    closedir(dp);
+}
+
+/*
+ * Run the test executable again, running only the given test
+ * test - the test to run
+ * tty - file descriptor to use for standard input, output and error, or -1
+ *      to use ours
+ *
+ * Returns: the process ID of the new process
+ */
+static pid_t __limpet_exec_test(struct __limpet_test *test, int tty) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    char *argv[2];
+    char **envp;
+    char *run_one;
+    char *rlimits;
+    char shared[sizeof(__LIMPET_RUN_SHARED "=") + 3 * sizeof(int)];
+    size_t n_env;
+    size_t run_one_size;
+    size_t rlimits_size;
+    pid_t pid;
+    int rc;
+
+    rc = posix_spawn_file_actions_init(&actions);
+    if (rc != 0) {
+        __limpet_fail_with(rc, "posix_spawn_file_actions_init failed");
+    }
+
+    /*
+     * Put the test in a process group of its own, as
+     * __limpet_new_process_group() does for the other strategies
+     */
+    rc = posix_spawnattr_init(&attr);
+    if (rc == 0) {
+        rc = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    }
+    if (rc == 0) {
+        rc = posix_spawnattr_setpgroup(&attr, 0);
+    }
+    if (rc != 0) {
+        __limpet_fail_with(rc, "Unable to set up posix_spawn attributes");
+    }
+
+    if (tty != -1) {
+        int fd;
+
+        for (fd = 0; fd <= 2; fd++) {
+            rc = posix_spawn_file_actions_adddup2(&actions, tty, fd);
+            if (rc != 0) {
+                __limpet_fail_with(rc, "posix_spawn_file_actions_adddup2 "
+                    "failed");
+            }
+        }
+    }
+
+    for (n_env = 0; environ[n_env] != NULL; n_env++) {
+    }
+
+    envp = (char **)malloc(sizeof(envp[0]) * (n_env + 4));
+    run_one_size = sizeof(__LIMPET_RUN_ONE "=") + strlen(test->name);
+    run_one = (char *)malloc(run_one_size);
+    if (envp == NULL || run_one == NULL) {
+        __limpet_fail("Out of memory allocating environment for %s\n",
+            test->name);
+    }
+
+    snprintf(run_one, run_one_size, "%s=%s", __LIMPET_RUN_ONE, test->name);
+    memcpy(envp, environ, sizeof(envp[0]) * n_env);
+    envp[n_env++] = run_one;
+
+    /*
+     * The configuration variables have been removed from the environment,
+     * but the new process needs the resource limits for all tests
+     */
+    rlimits = NULL;
+    if (test->params->rlimits != NULL) {
+        rlimits_size = sizeof(__LIMPET_RUN_RLIMITS "=") +
+            strlen(test->params->rlimits);
+        rlimits = (char *)malloc(rlimits_size);
+        if (rlimits == NULL) {
+            __limpet_fail("Out of memory allocating environment for %s\n",
+                test->name);
+        }
+        snprintf(rlimits, rlimits_size, "%s=%s", __LIMPET_RUN_RLIMITS,
+            test->params->rlimits);
+        envp[n_env++] = rlimits;
+    }
+
+    /*
+     * Duplicating the descriptor onto itself clears FD_CLOEXEC in the new
+     * process
+     */
+    if (__limpet_shared_fd != -1) {
+        rc = posix_spawn_file_actions_adddup2(&actions, __limpet_shared_fd,
+            __limpet_shared_fd);
+        if (rc != 0) {
+            __limpet_fail_with(rc, "posix_spawn_file_actions_adddup2 "
+                "failed");
+        }
+        snprintf(shared, sizeof(shared), "%s=%d", __LIMPET_RUN_SHARED,
+            __limpet_shared_fd);
+        envp[n_env++] = shared;
+    }
+    envp[n_env] = NULL;
+
+    argv[0] = program_invocation_name;
+    argv[1] = NULL;
+
+    rc = posix_spawn(&pid, "/proc/self/exe", &actions, &attr, argv, envp);
+    if (rc != 0) {
+        __limpet_fail_with(rc, "posix_spawn failed for test %s", test->name);
+    }
+
+    free(run_one);
+    free(rlimits);
+    free(envp);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    return pid;
+}
+
+/*
+ * Start a process for the test
+ * test - the test to run
+ * strategy - how to start the process
+ * tty - file descriptor the exec strategy will use for standard input,
+ *      output and error, or -1 to use ours. The other strategies leave it
+ *      to the child to set these up.
+ * pid_fd - set to a pidfd for the new process
+ *
+ * Returns: the process ID in the parent and zero in the child. The exec
+ *      strategy never returns in the child.
+ */
+static pid_t __limpet_spawn(struct __limpet_test *test,
+    enum __limpet_spawn_strategy strategy, int tty, int *pid_fd) {
+    pid_t pid;
+
+    *pid_fd = -1;
+
+    switch (strategy) {
+    case __limpet_spawn_fork:
+        pid = fork();
+        break;
+
+    case __limpet_spawn_clone3:
+        pid = __limpet_clone(0, pid_fd);
+        break;
+
+    case __limpet_spawn_exec:
+    default:
+        pid = __limpet_exec_test(test, tty);
+        break;
+    }
+
+    if (pid == -1) {
+        __limpet_fail_errno("Unable to start process for test %s",
+            test->name);
+    }
+
+    if (pid != 0 && *pid_fd == -1) {
+        *pid_fd = syscall(SYS_pidfd_open, pid, 0);
+        if (*pid_fd == -1) {
+            __limpet_fail_errno("pidfd_open failed for pid %d", pid);
+        }
+    }
+
+    return pid;
+}
+
+/*
+ * If we are a test executable that was run again by the exec strategy,
+ * get the name of the test to run.
+ *
+ * Returns: the name of the test, or NULL if all tests should be run
+ */
+static const char *__limpet_get_run_one(void) {
+    return getenv(__LIMPET_RUN_ONE);
+}
+
+/*
+ * If we are a test executable that was run again by the exec strategy,
+ * get the resource limits for all tests.
+ *
+ * Returns: the limits, or NULL if there are none
+ */
+static const char *__limpet_get_run_rlimits(void) {
+    return getenv(__LIMPET_RUN_RLIMITS);
+}
+
+static void *__limpet_get_run_shared(size_t size) {
+    const char *value;
+    char *endptr;
+    long fd;
+
+    value = getenv(__LIMPET_RUN_SHARED);
+    if (value == NULL) {
+        return NULL;
+    }
+
+    fd = strtol(value, &endptr, 10);
+    if (*value == '\0' || *endptr != '\0' || fd < 0 || fd > INT_MAX) {
+        __limpet_fail("Bad value for %s\n", __LIMPET_RUN_SHARED);
+    }
+
+    return __limpet_map_shared_fd((int)fd, size);
+}
+#endif /* _LIMPET_SPAWN_LINUX_H_ */
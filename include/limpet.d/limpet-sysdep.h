@@ -25,23 +25,115 @@
 #define __LIMPET_UNUSED  __attribute((unused))
 
 #define __LIMPET_DEFAULT_TIMEOUT     30.0
+#define __LIMPET_DEFAULT_KILL_GRACE  1.0
+#define __LIMPET_DEFAULT_BENCH_TIME  1.0
+#define __LIMPET_DEFAULT_BENCH_THRESHOLD 5.0
+
+/*
+ * A set of test names, kept as an open addressing hash table
+ * slots - the table, with NULL for empty slots. The number of slots is a
+ *      power of two.
+ * n_slots - number of elements in slots
+ */
+struct __limpet_name_set {
+    const char  **slots;
+    size_t      n_slots;
+};
+
+/*
+ * A list of test name patterns
+ * patterns - the patterns, which use the syntax of fnmatch()
+ * prefix_len - for each pattern, if its only special character is a '*' at
+ *      the end, the length of the part before the '*', otherwise
+ *      __LIMPET_NOT_PREFIX
+ * n_patterns - number of elements in patterns
+ */
+#define __LIMPET_NOT_PREFIX ((size_t)-1)
+
+struct __limpet_pattern_list {
+    const char  **patterns;
+    size_t      *prefix_len;
+    size_t      n_patterns;
+};
+
+/*
+ * Tests selected by the runlist. Entries starting with '-' exclude tests,
+ * others include them. Entries with no special characters are test names,
+ * which are put in a hash set. The others are patterns.
+ * given - true if a runlist was given. If not, all tests are run.
+ * n_includes - number of entries that include tests. If this is zero, all
+ *      tests that aren't excluded are run, unless there were no entries at
+ *      all, in which case nothing is run.
+ * n_excludes - number of entries that exclude tests
+ * include_names, include_patterns - entries that include tests
+ * exclude_names, exclude_patterns - entries that exclude tests
+ */
+struct __limpet_runlist {
+    bool                            given;
+    size_t                          n_includes;
+    size_t                          n_excludes;
+    struct __limpet_name_set        include_names;
+    struct __limpet_pattern_list    include_patterns;
+    struct __limpet_name_set        exclude_names;
+    struct __limpet_pattern_list    exclude_patterns;
+};
 
 /*
  * Parameters of the test run.
  * max_jobs - Maximum number of simultaneous threads. A zero value means
  *  there is no limit.
- * n_runlist - Number of items in runlist. If this is zero and runlist is
- *      NULL, run all tests. If this is zero and runlist is not NULL but
- *      empty, run nothing.
- * runlist - List of tests to run
+ * runlist - Tests to run
  * timeout - Number of seconds to allow each test to run
+ * kill_grace - Number of seconds a test that timed out is given to exit
+ *      after SIGTERM before it is sent SIGKILL
+ * bench_time - Number of seconds to spend running each benchmark
+ * bench_threshold - Percentage by which the median time of a benchmark
+ *      must exceed that of its baseline for it to have regressed
+ * bench_history - Name of the file to which benchmark results are
+ *      appended, or NULL
+ * bench_baseline - Build ID of the benchmark results to compare against,
+ *      or NULL to compare against the most recent results from another
+ *      build
+ * bench_gate - Benchmarks that fail the run if they regress
+ * perf - true if performance counters are to be read for each test
+ * inproc - true if tests defined with LIMPET_TEST_INPROC are run in the
+ *      process running the tests
+ * history - Name of the file used to record test durations, or NULL
+ * resources - Name of the file to which the resources used by each test
+ *      are written, or NULL
+ * report - Space-separated list of reports to write, each of the form
+ *      format:file, or NULL
+ * rlimits - Space-separated list of resource limits for all tests, each of
+ *      the form resource=value, or NULL
+ * shard_index - The shard of the tests this run is responsible for
+ * shard_count - Number of shards the tests are divided into
+ * shard_by - How tests are assigned to shards
  */
+enum __limpet_shard_by {
+    __limpet_shard_by_hash,
+    __limpet_shard_by_duration,
+};
+
 struct __limpet_params {
-    unsigned    max_jobs;
-    size_t      n_runlist;
-    char        **runlist;
-    float       timeout;
-    bool        verbose;
+    unsigned                max_jobs;
+    struct __limpet_runlist runlist;
+    float                   timeout;
+    float                   kill_grace;
+    float                   bench_time;
+    float                   bench_threshold;
+    bool                    verbose;
+    bool                    perf;
+    bool                    inproc;
+    const char              *history;
+    const char              *resources;
+    const char              *report;
+    const char              *rlimits;
+    const char              *bench_history;
+    const char              *bench_baseline;
+    struct __limpet_pattern_list bench_gate;
+    unsigned                shard_index;
+    unsigned                shard_count;
+    enum __limpet_shard_by  shard_by;
 };
 
 /*
@@ -49,6 +141,125 @@ struct __limpet_params {
  */
 struct __limpet_params __limpet_params __attribute((common));
 
+/*
+ * Results of a benchmark, with times in nanoseconds per iteration
+ * iterations - number of iterations in each sample, or zero if the test
+ *      isn't a benchmark
+ * samples - number of times the iterations were timed
+ * mean, median, min, max - statistics of the samples
+ * mad - median absolute deviation of the samples from the median
+ */
+struct __limpet_bench_result {
+    unsigned long long  iterations;
+    unsigned            samples;
+    double              mean;
+    double              median;
+    double              min;
+    double              max;
+    double              mad;
+};
+
+/*
+ * Results of an earlier run of a benchmark, from the benchmark history
+ * build_id - build ID of the test executable that produced them
+ * bench - the results
+ */
+struct __limpet_bench_baseline {
+    char                            *build_id;
+    struct __limpet_bench_result    bench;
+};
+
+/*
+ * Performance counters read for each test when the perf parameter is set.
+ * Counters the system doesn't support, such as hardware counters in many
+ * virtual machines, are left out.
+ */
+enum __limpet_perf_counter {
+    __limpet_perf_task_clock,
+    __limpet_perf_page_faults,
+    __limpet_perf_context_switches,
+    __limpet_perf_instructions,
+    __limpet_perf_cycles,
+    __limpet_perf_cache_misses,
+    __LIMPET_PERF_COUNTERS,
+};
+
+/*
+ * Names of the performance counters, as used in the test trailer and
+ * reports, in the order of enum __limpet_perf_counter
+ */
+static const char *__limpet_perf_names[] = {
+    "task_clock_ns",
+    "page_faults",
+    "context_switches",
+    "instructions",
+    "cycles",
+    "cache_misses",
+};
+
+/*
+ * Performance counter values for a test
+ * attached - set by the process running the tests once it has opened the
+ *      counters for the test process
+ * counted - true for each counter that was read
+ * values - value of each counter that was read
+ */
+struct __limpet_perf_result {
+    bool                attached;
+    bool                counted[__LIMPET_PERF_COUNTERS];
+    unsigned long long  values[__LIMPET_PERF_COUNTERS];
+};
+
+/*
+ * Results the test process passes back to the process running the tests,
+ * through memory shared between them
+ * bench - results of a benchmark
+ * perf - performance counter values
+ */
+struct __limpet_results {
+    struct __limpet_bench_result    bench;
+    struct __limpet_perf_result     perf;
+};
+
+/*
+ * A fixture, set up once in the process running the tests and inherited
+ * by the tests that use it
+ * name - name of the fixture
+ * setup - function that sets up the fixture
+ * teardown - function that tears it down, or NULL
+ * pending - number of tests using the fixture that are still to complete
+ * set_up - true once the fixture has been set up in this process
+ */
+struct __limpet_fixture {
+    const char  *name;
+    void        (*setup)(void);
+    void        (*teardown)(void);
+    unsigned    pending;
+    bool        set_up;
+};
+
+/*
+ * The teardown function for a fixture, defined apart from the fixture
+ */
+struct __limpet_teardown {
+    struct __limpet_fixture *fixture;
+    void                    (*func)(void);
+};
+
+/*
+ * The table of a test defined with LIMPET_TEST_P, which is run once for
+ * each row
+ * rows - number of rows in the table
+ * tests - array of rows tests, filled in from the test registered for the
+ *      table before the tests are run
+ * func - function that runs the test with the given row of the table
+ */
+struct __limpet_table {
+    size_t                  rows;
+    struct __limpet_test    *tests;
+    void                    (*func)(size_t row);
+};
+
 /*
  * Per-test information. This part is common to all implementations
  *  next - Pointer to next test to run
@@ -56,7 +267,27 @@ struct __limpet_params __limpet_params __attribute((common));
  *  skipped - true if this test was skipped
  *  name - Name of the test
  *  func - Function to execute the test
+ *  file - Name of the source file in which the test is defined
+ *  line - Line of the source file on which the test is defined
+ *  tags - Space-separated list of tags given to the test, or NULL
+ *  rlimits - Space-separated list of resource limits for the test, which
+ *      override those given for all tests, or NULL
  *  next - Next item on the list of tests, or NULL at the end.
+ *  start_time - Time at which the test was started, from __limpet_now()
+ *  duration - Number of seconds the test ran, set by the system-dependent
+ *      code when the test completes
+ *  expected_duration - Number of seconds the test took the last time it
+ *      was run, or a negative value if not known
+ *  shard - The shard to which the test is assigned
+ *  results - Results passed back by the test process, or NULL if there is
+ *      nowhere to put them
+ *  baseline - Earlier results of a benchmark to compare with this run's,
+ *      or NULL if there are none
+ *  fixture - The fixture the test uses, or NULL
+ *  table - For a test defined with LIMPET_TEST_P, its table, or NULL
+ *  row - For a test defined with LIMPET_TEST_P, the row of the table with
+ *      which this instance of it is run
+ *  inproc - true if the test may be run in the process running the tests
  *  sysdep - System-dependent information
  */
 struct __limpet_test {
@@ -65,7 +296,21 @@ struct __limpet_test {
     bool                    skipped;
     const char *            name;
     void                    (*func)(void);
+    const char              *file;
+    unsigned                line;
+    const char              *tags;
+    const char              *rlimits;
     struct __limpet_params  *params;
+    double                  start_time;
+    double                  duration;
+    double                  expected_duration;
+    unsigned                shard;
+    struct __limpet_results *results;
+    struct __limpet_bench_baseline *baseline;
+    struct __limpet_fixture *fixture;
+    struct __limpet_table   *table;
+    size_t                  row;
+    bool                    inproc;
     struct __limpet_sysdep  sysdep;
 };
 
@@ -75,6 +320,13 @@ struct __limpet_test {
 static void __limpet_inc_passed(void);
 static void __limpet_inc_failed(void);
 static void __limpet_enqueue_done(struct __limpet_test *test);
+static bool __limpet_parse_bool(const char *name, const char *value,
+    bool default_value);
+static struct __limpet_test *__limpet_first_test(void);
+static struct __limpet_test *__limpet_next_test(struct __limpet_test *test);
+static struct __limpet_test *__limpet_find_test(const char *name);
+static void __limpet_call_test(struct __limpet_test *test);
+static bool __limpet_call_inproc(struct __limpet_test *test);
 
 /*
  * Define a constant value for initializing __limpet_sysdep
@@ -107,12 +359,153 @@ static const char *__limpet_get_maxjobs(void);
 static const char *__limpet_get_runlist(void);
 static const char *__limpet_get_verbose(void);
 static const char *__limpet_get_timeout(void);
+static const char *__limpet_get_kill_grace(void);
+static const char *__limpet_get_history(void);
+static const char *__limpet_get_resources(void);
+static const char *__limpet_get_shard_index(void);
+static const char *__limpet_get_shard_count(void);
+static const char *__limpet_get_shard_by(void);
+static const char *__limpet_get_list(void);
+static const char *__limpet_get_report(void);
+static const char *__limpet_get_rlimits(void);
+static const char *__limpet_get_bench_time(void);
+static const char *__limpet_get_bench_threshold(void);
+static const char *__limpet_get_bench_history(void);
+static const char *__limpet_get_bench_baseline(void);
+static const char *__limpet_get_bench_gate(void);
+static const char *__limpet_get_perf(void);
+static const char *__limpet_get_inproc(void);
 
+/*
+ * Parse any configuration variables specific to the system-dependent code.
+ * This is called before __limpet_parse_done().
+ */
+static void __limpet_parse_sysdep_params(void);
 static void __limpet_parse_done(void);
 
+/*
+ * If this process was started to run a single test, return the name of
+ * the test, otherwise return NULL
+ */
+static const char *__limpet_get_run_one(void);
+
+/*
+ * Allocate size bytes of zeroed memory that is shared with the processes
+ * started to run tests, however they are started
+ */
+static void *__limpet_map_shared(size_t size);
+
+/*
+ * In a process started to run a single test, map the memory allocated by
+ * __limpet_map_shared() in the process running the tests
+ *
+ * Returns: the memory, or NULL if it wasn't passed to us
+ */
+static void *__limpet_get_run_shared(size_t size);
+
+/*
+ * In a process started to run a single test, return the resource limits
+ * given for all tests, or NULL if there are none
+ */
+static const char *__limpet_get_run_rlimits(void);
+
+/*
+ * Fail if a list of resource limits can't be parsed. what says what the
+ * limits are for.
+ */
+static void __limpet_check_rlimits(const char *spec, const char *what);
+
+/*
+ * Running in the context of a test child process, apply the resource
+ * limits for the test
+ */
+static void __limpet_apply_rlimits(struct __limpet_test *test);
+
+/*
+ * Running in the context of a test child process, start counting the
+ * performance counters for the test. They are read into the test's results
+ * when the process exits.
+ */
+static void __limpet_perf_start(struct __limpet_test *test);
+
+/*
+ * Print the performance counter values of a completed test
+ */
+static void __limpet_print_perf(const struct __limpet_perf_result *perf);
+
+/*
+ * Returns: true if test processes inherit the memory of the process running
+ *      the tests, so that fixtures set up there are seen by the tests
+ */
+static bool __limpet_fixtures_inherited(void);
+
+/*
+ * Called once the parameters have been parsed and before any test is
+ * started
+ */
+static void __limpet_sysdep_init(void);
+
+/*
+ * Returns the current time, in seconds, from a clock that is not affected
+ * by changes to the time of day
+ */
+static double __limpet_now(void);
+
+/*
+ * Read the durations recorded for the tests in the given history file,
+ * setting expected_duration for each test found, and write the durations
+ * from this run back to it.
+ */
+static void __limpet_read_history(const char *path);
+static void __limpet_write_history(const char *path);
+
+/*
+ * Returns: a string identifying the build of this test executable, such as
+ *      its GNU build ID in hex
+ */
+static const char *__limpet_build_id(void);
+
+/*
+ * Find the baseline for each benchmark in the given benchmark history
+ * file, and append the results of the benchmarks run this time to it.
+ * baseline is the build ID of the results to use as baselines or NULL to
+ * use the most recent results from another build.
+ */
+static void __limpet_read_bench_history(const char *path,
+    const char *baseline);
+static void __limpet_write_bench_history(const char *path);
+
+/*
+ * Print the resources used by a completed test, and write them for all
+ * tests that were run to the given file.
+ */
+static void __limpet_print_resources(struct __limpet_test *test);
+static void __limpet_write_resources(const char *path);
+
+/*
+ * Open the reports given by a space-separated list of format:file
+ * entries, write the result of each test to them as it is reported or
+ * skipped, and finish them after all tests have been reported.
+ */
+static void __limpet_open_reports(const char *spec);
+static void __limpet_report_test(struct __limpet_test *test);
+static void __limpet_close_reports(void);
+
+/*
+ * Write the first len characters of a string to fp as a JSON string
+ */
+static void __limpet_fprint_json_string(FILE *fp, const char *s,
+    size_t len);
+
 static ssize_t __limpet_dump_stored_log(struct __limpet_test *test);
 static void __limpet_start_one(struct __limpet_test *test);
 static void __limpet_cleanup_test(struct __limpet_test *test);
+
+/*
+ * Run a test in the process running the tests, capturing its output just
+ * as if it had been started by __limpet_start_one()
+ */
+static void __limpet_start_inproc(struct __limpet_test *test);
 static void __limpet_print_status(struct __limpet_test *test);
 
 /*
@@ -18,61 +18,250 @@
 #error LIMPET is not supported
 #endif
 
+#include "limpet.d/limpet-bench.h"
+
 /*
  * These definitions are intended for use by the user code
  * =======================================================
  */
 
 /*
- * The tests use two constructor priorities, which can be overridden
- *  __LIMPET_SETUP_PRI - prority to run the constructors that set up each
- *      test for execution. This priority must cause these constructors to
- *      run before those running at __LIMPET_RUN_PRI.
- *  __LIMPET_RUN_PRI - run all tests
- * These will generally be the highest and second highest constructor
- * priorities. If necessary, these can be overridden  by defining one or
- * both before #including this file:
+ * All tests are run by a constructor with this priority, which will
+ * generally be the highest constructor priority. If necessary, it can be
+ * overridden by defining it before #including this file:
  */
-#ifndef __LIMPET_SETUP_PRI
-#define __LIMPET_SETUP_PRI   101
-#endif
-
 #ifndef __LIMPET_RUN_PRI
 #define __LIMPET_RUN_PRI     102
 #endif
 
+/*
+ * Name of the ELF section holding a pointer to each test. Since this is a
+ * valid C identifier, the linker defines __start_limpet_tests and
+ * __stop_limpet_tests to mark its beginning and end.
+ */
+#define __LIMPET_SECTION    "limpet_tests"
+
+/*
+ * Name of the ELF section holding a pointer to the teardown function of
+ * each fixture that has one
+ */
+#define __LIMPET_TEARDOWN_SECTION "limpet_teardowns"
+
 /*
  * Used to define a test. Usage:
  *  LEAVEIN(testname) {
  *      <test body>
  *  }
  *
- * This actually defines two functions. The first function has the given
- * testnane, prefixed by __limpet_, denoted by __limpet_<testname>.
- * This function is called as a highest priority constructor. The second
- * function is the user's test function, with the name given in testname.
+ * This defines the user's test function, with the name given in testname,
+ * and a statically initialized struct __limpet_test describing it, named
+ * __limpet_test_<testname>. A pointer to the struct __limpet_test is placed
+ * in the __LIMPET_SECTION section, so finding the tests costs nothing
+ * until they are run.
+ */
+#define LIMPET_TEST(testname) LIMPET_TEST_TAGS(testname, NULL)
+
+/*
+ * Used to define a test with tags, which are listed along with the test
+ * when LIMPET_LIST is true. Usage:
+ *  LIMPET_TEST_TAGS(testname, "slow network") {
+ *      <test body>
+ *  }
+ */
+#define LIMPET_TEST_TAGS(testname, test_tags) \
+    __LIMPET_DEFINE_TEST(testname, test_tags, NULL, NULL, false)
+
+/*
+ * Used to define a test with resource limits, which override those given
+ * in LIMPET_RLIMITS for all tests. Usage:
+ *  LIMPET_TEST_RLIMITS(testname, "as=256M cpu=5") {
+ *      <test body>
+ *  }
+ */
+#define LIMPET_TEST_RLIMITS(testname, test_rlimits) \
+    __LIMPET_DEFINE_TEST(testname, NULL, test_rlimits, NULL, false)
+
+/*
+ * Used to define a test that may be run in the process running the tests,
+ * rather than in a process of its own, when LIMPET_INPROC is true. This
+ * saves the cost of starting a process, which can be far more than that of
+ * a small test, such as one of a pure function. A failed assertion still
+ * fails only the test, but the test must not crash, exit, hang or leave
+ * behind anything that would affect the tests that follow it. Usage:
+ *  LIMPET_TEST_INPROC(testname) {
+ *      <test body>
+ *  }
+ */
+#define LIMPET_TEST_INPROC(testname) \
+    __LIMPET_DEFINE_TEST(testname, NULL, NULL, NULL, true)
+
+/*
+ * Used to define a fixture, which is set up once, in the process running
+ * the tests, before any test is started. Tests defined with LIMPET_TEST_F
+ * inherit whatever it sets up, such as a large table kept in a static
+ * variable, through copy-on-write memory. Usage:
+ *  LIMPET_FIXTURE(fixturename) {
+ *      <fixture setup>
+ *  }
  *
- * __limpet_<testname> is responsible for setting up anything required by
- * the user's test and then linking it into a list for later processing.
+ * A fixture may have a teardown, which is run once the last test using
+ * the fixture has completed:
+ *  LIMPET_FIXTURE_TEARDOWN(fixturename) {
+ *      <fixture teardown>
+ *  }
  */
-#define LIMPET_TEST(testname) \
-    static void __limpet_test_ ## testname(void)            \
-        __attribute((constructor(__LIMPET_SETUP_PRI)));     \
-    static void testname(void);                             \
-    static void __limpet_test_ ## testname(void) {          \
-        static struct __limpet_test common = {              \
-            .next = NULL,                                   \
-            .done = NULL,                                   \
-            .skipped = false,                               \
-            .name = #testname,                              \
-            .func = testname,                               \
-            .params = &__limpet_params,                     \
-            .sysdep = __LIMPET_SYSDEP_INIT,                 \
-        };                                                  \
-        __limpet_enqueue_test(&common);                     \
+#define LIMPET_FIXTURE(fixturename) \
+    static void __limpet_fixture_setup_ ## fixturename(void); \
+    static struct __limpet_fixture __limpet_fixture_ ## fixturename = { \
+        .name = #fixturename,                               \
+        .setup = __limpet_fixture_setup_ ## fixturename,    \
+        .teardown = NULL,                                   \
+        .pending = 0,                                       \
+        .set_up = false,                                    \
+    };                                                      \
+    static void __limpet_fixture_setup_ ## fixturename(void)
+
+#define LIMPET_FIXTURE_TEARDOWN(fixturename) \
+    static void __limpet_fixture_teardown_ ## fixturename(void); \
+    static struct __limpet_teardown __limpet_teardown_ ## fixturename = { \
+        .fixture = &__limpet_fixture_ ## fixturename,       \
+        .func = __limpet_fixture_teardown_ ## fixturename,  \
+    };                                                      \
+    static struct __limpet_teardown *__limpet_teardown_entry_ ## fixturename \
+        __attribute((used, section(__LIMPET_TEARDOWN_SECTION))) = \
+        &__limpet_teardown_ ## fixturename;                 \
+    static void __limpet_fixture_teardown_ ## fixturename(void)
+
+/*
+ * Used to define a test that uses a fixture. Usage:
+ *  LIMPET_TEST_F(fixturename, testname) {
+ *      <test body>
+ *  }
+ */
+#define LIMPET_TEST_F(fixturename, testname) \
+    __LIMPET_DEFINE_TEST(testname, NULL, NULL,              \
+        &__limpet_fixture_ ## fixturename, false)
+
+/*
+ * Used to define a test that is run once for each row of a table, which
+ * is an array defined before the test. Each row is a test of its own,
+ * named for the test and the index of the row, such as testname/17, so
+ * it can be selected in LIMPET_RUNLIST and run in parallel with the
+ * others. The body gets the row in limpet_param. Usage:
+ *  static const size_t sizes[] = { 1, 17, 4096 };
+ *
+ *  LIMPET_TEST_P(testname, sizes) {
+ *      <test body using limpet_param>
+ *  }
+ *
+ * Only the struct __limpet_test for each row takes space for each row. It
+ * is filled in when the tests are run.
+ */
+#define LIMPET_TEST_P(testname, test_table) \
+    static void testname(__typeof__((test_table)[0]) limpet_param); \
+    static void __limpet_row_ ## testname(size_t row) {     \
+        testname((test_table)[row]);                        \
+    }                                                       \
+    static struct __limpet_test                             \
+        __limpet_rows_ ## testname[__LIMPET_ARRAY_SIZE(test_table)]; \
+    static struct __limpet_table __limpet_table_ ## testname = { \
+        .rows = __LIMPET_ARRAY_SIZE(test_table),            \
+        .tests = __limpet_rows_ ## testname,                \
+        .func = __limpet_row_ ## testname,                  \
+    };                                                      \
+    __LIMPET_REGISTER_TEST(testname, NULL, NULL, NULL, NULL, \
+        &__limpet_table_ ## testname, false)                \
+    static void testname(__typeof__((test_table)[0]) limpet_param)
+
+/*
+ * Used to define a microbenchmark. The body of LIMPET_BENCH_LOOP is what
+ * is timed, so setup can be done before it. Usage:
+ *  LIMPET_BENCH(benchname) {
+ *      <setup>
+ *      LIMPET_BENCH_LOOP {
+ *          limpet_do_not_optimize(<code to time>);
+ *      }
+ *  }
+ *
+ * The benchmark function is called with the number of iterations to run,
+ * which LIMPET_BENCH_LOOP uses. It is called several times, so anything
+ * set up should be cleaned up before returning.
+ */
+#define LIMPET_BENCH(benchname) \
+    static void benchname(unsigned long long __limpet_bench_iterations); \
+    static void __limpet_bench_ ## benchname(void);         \
+    __LIMPET_REGISTER_TEST(benchname, __limpet_bench_ ## benchname, NULL, \
+        NULL, NULL, NULL, false)                            \
+    static void __limpet_bench_ ## benchname(void) {        \
+        __limpet_run_bench(&__limpet_test_ ## benchname, benchname); \
     }                                                       \
+    static void benchname(unsigned long long __limpet_bench_iterations)
+
+#define LIMPET_BENCH_LOOP \
+    for (unsigned long long __limpet_bench_i = __limpet_bench_start(); \
+        __limpet_bench_i < __limpet_bench_iterations ||     \
+        __limpet_bench_stop();                              \
+        __limpet_bench_i++)
+
+/*
+ * Keep the compiler from optimizing away the computation of a value, or
+ * from assuming anything about memory, in a benchmark. A value that fits
+ * in a register can be left in one. Anything larger, such as a struct, is
+ * made to be stored in memory by passing its address.
+ */
+#define limpet_do_not_optimize(value) \
+    do {                                                    \
+        __typeof__(value) __limpet_value = (value);         \
+        if (sizeof(__limpet_value) <= sizeof(void *)) {     \
+            __asm__ __volatile__("" : : "r,m"(__limpet_value) : "memory"); \
+        } else {                                            \
+            __asm__ __volatile__("" : : "r"(&__limpet_value) : "memory"); \
+        }                                                   \
+    } while (0)
+#define limpet_clobber_memory() \
+    __asm__ __volatile__("" : : : "memory")
+
+#define __LIMPET_DEFINE_TEST(testname, test_tags, test_rlimits, \
+    test_fixture, test_inproc)                              \
+    static void testname(void);                             \
+    __LIMPET_REGISTER_TEST(testname, testname, test_tags, test_rlimits, \
+        test_fixture, NULL, test_inproc)                    \
     void testname(void)
 
+/*
+ * Define the struct __limpet_test for a test and put a pointer to it in
+ * the __LIMPET_SECTION section. For a test with a table, this is only the
+ * pattern for the test run for each row.
+ */
+#define __LIMPET_REGISTER_TEST(testname, testfunc, test_tags, test_rlimits, \
+    test_fixture, test_table, test_inproc)                  \
+    static struct __limpet_test __limpet_test_ ## testname = { \
+        .next = NULL,                                       \
+        .done = NULL,                                       \
+        .skipped = false,                                   \
+        .name = #testname,                                  \
+        .func = testfunc,                                   \
+        .file = __FILE__,                                   \
+        .line = __LINE__,                                   \
+        .tags = test_tags,                                  \
+        .rlimits = test_rlimits,                            \
+        .params = &__limpet_params,                         \
+        .start_time = 0,                                    \
+        .duration = 0,                                      \
+        .expected_duration = -1,                            \
+        .shard = 0,                                         \
+        .results = NULL,                                    \
+        .baseline = NULL,                                   \
+        .fixture = test_fixture,                            \
+        .table = test_table,                                \
+        .row = 0,                                           \
+        .inproc = test_inproc,                              \
+        .sysdep = __LIMPET_SYSDEP_INIT,                     \
+    };                                                      \
+    static struct __limpet_test *__limpet_entry_ ## testname \
+        __attribute((used, section(__LIMPET_SECTION))) =    \
+        &__limpet_test_ ## testname;
+
 #define __limpet_assert_failed(assertion) \
     __limpet_fail("Assertion '%s' failed: line %u file %s\n", \
         #assertion, __LINE__, __FILE__)
@@ -111,79 +300,328 @@
 #define __LIMPET_MARKER "> "
 
 /*
- * Add a test name to the run list
- * start - pointer to the beginning of the test name
- * end - pointer one past the end of the test name
- * params - pointer to the structure storing the configuration
- *
- * Returns: true if successful, false otherwise.
+ * Hash a test name, using FNV-1a
+ */
+static size_t __limpet_hash_name(const char *name) {
+    size_t hash;
+
+    hash = 2166136261u;
+    for (; *name != '\0'; name++) {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/*
+ * Allocate a set that can hold n names
  */
-static void __limpet_add_testname(struct __limpet_params *params,
-    const char *start, const char *end) {
-    size_t testname_size;
-    char *testname;
-    size_t new_runlist_size;
+static void __limpet_name_set_init(struct __limpet_name_set *set, size_t n) {
+    set->n_slots = 1;
+    while (set->n_slots < 2 * n) {
+        set->n_slots *= 2;
+    }
+
+    set->slots = (const char **)calloc(set->n_slots, sizeof(set->slots[0]));
+    if (set->slots == NULL) {
+        __limpet_fail("Out of memory allocating %zu slots for test names\n",
+            set->n_slots);
+    }
+}
+
+/*
+ * Find the slot in which the given name is, or would be, stored
+ */
+static const char **__limpet_name_set_slot(struct __limpet_name_set *set,
+    const char *name) {
+    size_t mask;
+    size_t i;
+
+    mask = set->n_slots - 1;
+    for (i = __limpet_hash_name(name) & mask;
+        set->slots[i] != NULL && strcmp(set->slots[i], name) != 0;
+        i = (i + 1) & mask) {
+    }
+
+    return &set->slots[i];
+}
+
+static void __limpet_name_set_add(struct __limpet_name_set *set,
+    const char *name) {
+    *__limpet_name_set_slot(set, name) = name;
+}
+
+static bool __limpet_name_set_contains(struct __limpet_name_set *set,
+    const char *name) {
+    return *__limpet_name_set_slot(set, name) != NULL;
+}
 
-    testname_size = end - start;
-    testname = (char *)malloc(testname_size);
-    if (testname == NULL) {
-        __limpet_fail("Out of memory allocating %zu bytes for test name\n",
-            testname_size);
+/*
+ * Allocate a pattern list that can hold n patterns
+ */
+static void __limpet_pattern_list_init(struct __limpet_pattern_list *list,
+    size_t n) {
+    list->patterns = (const char **)malloc(sizeof(list->patterns[0]) *
+        (n + 1));
+    list->prefix_len = (size_t *)malloc(sizeof(list->prefix_len[0]) *
+        (n + 1));
+    if (list->patterns == NULL || list->prefix_len == NULL) {
+        __limpet_fail("Out of memory allocating %zu patterns\n", n);
     }
+    list->n_patterns = 0;
+}
+
+/*
+ * Add a pattern to a list. Patterns like "name*" are common, so they are
+ * matched by comparing prefixes rather than with fnmatch().
+ */
+static void __limpet_pattern_list_add(struct __limpet_pattern_list *list,
+    const char *pattern) {
+    const char *special;
+    size_t len;
+
+    len = strlen(pattern);
+    special = strpbrk(pattern, "*?[\\");
+
+    list->patterns[list->n_patterns] = pattern;
+    list->prefix_len[list->n_patterns] =
+        (special == pattern + len - 1 && *special == '*') ? len - 1 :
+        __LIMPET_NOT_PREFIX;
+    list->n_patterns += 1;
+}
 
-    strncpy(testname, start, testname_size);
+static bool __limpet_pattern_list_match(struct __limpet_pattern_list *list,
+    const char *name) {
+    size_t i;
 
-    new_runlist_size = sizeof(params->runlist[0]) * (params->n_runlist + 1);
-    params->runlist = (char **)realloc(params->runlist, new_runlist_size);
-    if (params->runlist == NULL) {
-        __limpet_fail("Unable to realloc %zu bytes\n", new_runlist_size);
+    for (i = 0; i < list->n_patterns; i++) {
+        if (list->prefix_len[i] != __LIMPET_NOT_PREFIX) {
+            if (strncmp(name, list->patterns[i], list->prefix_len[i]) == 0) {
+                return true;
+            }
+        } else if (fnmatch(list->patterns[i], name, 0) == 0) {
+            return true;
+        }
     }
 
-    params->runlist[params->n_runlist] = testname;
-    params->n_runlist += 1;
+    return false;
 }
 
 /*
- * Parse the runlist, if any
+ * Parse the runlist, if any. This is a space-separated list of test names
+ * and fnmatch() patterns, which may be preceeded by '-' to exclude tests.
  * params - Pointer to the configuration structure
  *
  * Returns: true on success, false otherwise
  */
 static bool __limpet_parse_runlist(struct __limpet_params *params) {
+    struct __limpet_runlist *runlist;
     const char *runlist_env;
+    char *entries;
+    char *start;
+    char *space;
+    size_t n_entries;
 
     runlist_env = __limpet_get_runlist();
+    if (runlist_env == NULL) {
+        return true;
+    }
+
+    runlist = &params->runlist;
+    runlist->given = true;
+
+    /*
+     * The entries point into a copy of the runlist, which is kept for as
+     * long as we run
+     */
+    entries = strdup(runlist_env);
+    if (entries == NULL) {
+        __limpet_fail("Out of memory copying runlist\n");
+    }
 
-    if (runlist_env != NULL) {
-        const char *start;
-        const char *space;
+    n_entries = 1;
+    for (space = strchr(entries, ' '); space != NULL;
+        space = strchr(space + 1, ' ')) {
+        n_entries++;
+    }
 
-        params->runlist = NULL;
-        start = runlist_env;
+    __limpet_name_set_init(&runlist->include_names, n_entries);
+    __limpet_name_set_init(&runlist->exclude_names, n_entries);
+    __limpet_pattern_list_init(&runlist->include_patterns, n_entries);
+    __limpet_pattern_list_init(&runlist->exclude_patterns, n_entries);
 
-        for (space = strchr(start, ' '); space != NULL;
-            space = strchr(start, ' ')) {
+    for (start = entries; *start != '\0'; start = space + 1) {
+        bool exclude;
 
-            if (start == space) {
-                __limpet_fail("Zero length test name invalid in %s\n",
-                    runlist_env);
-            }
+        space = strchr(start, ' ');
+        if (space == NULL) {
+            space = start + strlen(start) - 1;
+        } else {
+            *space = '\0';
+        }
 
-            __limpet_add_testname(params, start, space);
-            start = space + 1;
+        exclude = *start == '-';
+        if (exclude) {
+            start++;
         }
 
-        if (*start != '\0') {
-            size_t name_len;
+        if (*start == '\0') {
+            __limpet_fail("Zero length test name invalid in %s\n",
+                runlist_env);
+        }
+
+        if (strpbrk(start, "*?[\\") == NULL) {
+            __limpet_name_set_add(exclude ? &runlist->exclude_names :
+                &runlist->include_names, start);
+        } else {
+            __limpet_pattern_list_add(exclude ?
+                &runlist->exclude_patterns : &runlist->include_patterns,
+                start);
+        }
 
-            name_len = strlen(start);
-            __limpet_add_testname(params, start, start + name_len);
+        if (exclude) {
+            runlist->n_excludes += 1;
+        } else {
+            runlist->n_includes += 1;
         }
     }
 
     return true;
 }
 
+/*
+ * Parse a boolean configuration variable
+ * name - name of the configuration variable, for error messages
+ * value - value of the variable, or NULL if it was not set
+ * default_value - value to use if the variable was not set
+ *
+ * Returns: the value of the variable
+ */
+static bool __limpet_parse_bool(const char *name, const char *value,
+    bool default_value) {
+    if (value == NULL) {
+        return default_value;
+    }
+
+    if (strcmp(value, "true") == 0) {
+        return true;
+    }
+
+    if (strcmp(value, "false") != 0) {
+        __limpet_fail("%s must be true or false\n", name);
+    }
+
+    return false;
+}
+
+/*
+ * Parse an unsigned configuration variable
+ * name - name of the configuration variable, for error messages
+ * value - value of the variable, or NULL if it was not set
+ * default_value - value to use if the variable was not set
+ *
+ * Returns: the value of the variable
+ */
+static unsigned __limpet_parse_unsigned(const char *name, const char *value,
+    unsigned default_value) {
+    unsigned long result;
+    char *endptr;
+
+    if (value == NULL) {
+        return default_value;
+    }
+
+    errno = 0;
+    result = strtoul(value, &endptr, 0);
+    if (*value == '\0' || *endptr != '\0' || errno != 0 ||
+        result > UINT_MAX) {
+        __limpet_fail("%s must be a non-negative integer\n", name);
+    }
+
+    return (unsigned)result;
+}
+
+/*
+ * Parse the sharding configuration variables
+ * params - pointer to the structure storing the configuration
+ */
+static void __limpet_parse_shards(struct __limpet_params *params) {
+    const char *shard_by;
+
+    params->shard_count = __limpet_parse_unsigned("SHARD_COUNT",
+        __limpet_get_shard_count(), 1);
+    params->shard_index = __limpet_parse_unsigned("SHARD_INDEX",
+        __limpet_get_shard_index(), 0);
+
+    if (params->shard_count == 0) {
+        __limpet_fail("SHARD_COUNT must be at least one\n");
+    }
+
+    if (params->shard_index >= params->shard_count) {
+        __limpet_fail("SHARD_INDEX must be less than SHARD_COUNT (%u)\n",
+            params->shard_count);
+    }
+
+    shard_by = __limpet_get_shard_by();
+    if (shard_by == NULL || strcmp(shard_by, "hash") == 0) {
+        params->shard_by = __limpet_shard_by_hash;
+    } else if (strcmp(shard_by, "duration") == 0) {
+        params->shard_by = __limpet_shard_by_duration;
+        if (params->history == NULL) {
+            __limpet_fail("SHARD_BY=duration needs a HISTORY file\n");
+        }
+    } else {
+        __limpet_fail("SHARD_BY must be hash or duration\n");
+    }
+}
+
+/*
+ * Parse the list of gated benchmarks, which fail the run if they regress.
+ * This is a space-separated list of benchmark names and fnmatch()
+ * patterns.
+ */
+static void __limpet_parse_bench_gate(struct __limpet_params *params) {
+    const char *bench_gate;
+    char *entries;
+    char *start;
+    char *space;
+    size_t n_entries;
+
+    bench_gate = __limpet_get_bench_gate();
+    if (bench_gate == NULL) {
+        return;
+    }
+
+    /*
+     * As with the runlist, the patterns point into a copy that is kept
+     * for as long as we run
+     */
+    entries = strdup(bench_gate);
+    if (entries == NULL) {
+        __limpet_fail("Out of memory copying benchmark gate\n");
+    }
+
+    n_entries = 1;
+    for (space = strchr(entries, ' '); space != NULL;
+        space = strchr(space + 1, ' ')) {
+        n_entries++;
+    }
+
+    __limpet_pattern_list_init(&params->bench_gate, n_entries);
+
+    for (start = entries; start != NULL; start = space) {
+        space = strchr(start, ' ');
+        if (space != NULL) {
+            *space++ = '\0';
+        }
+
+        if (*start != '\0') {
+            __limpet_pattern_list_add(&params->bench_gate, start);
+        }
+    }
+}
+
 /*
  * Parse environment variables to get the configuration
  * params - pointer to the structure storing the configuration
@@ -193,6 +631,9 @@ static bool __limpet_parse_runlist(struct __limpet_params *params) {
 static bool __limpet_parse_params(struct __limpet_params *params) {
     const char *max_jobs_env;
     const char *timeout;
+    const char *kill_grace;
+    const char *bench_time;
+    const char *bench_threshold;
     const char *verbose_env;
 
     memset(params, 0, sizeof(*params));
@@ -226,18 +667,69 @@ static bool __limpet_parse_params(struct __limpet_params *params) {
         }
     }
 
-    verbose_env = __limpet_get_verbose();
+    kill_grace = __limpet_get_kill_grace();
 
-    if (verbose_env != NULL) {
-        if (strcmp(verbose_env, "true") == 0) {
-            params->verbose = true;
-        } else if (strcmp(verbose_env, "false") == 0) {
-            params->verbose = false;
-        } else {
-            __limpet_fail("VERBOSE must be true or false\n");
+    if (kill_grace == NULL) {
+        params->kill_grace = __LIMPET_DEFAULT_KILL_GRACE;
+    } else {
+        char *endptr;
+
+        params->kill_grace = strtof(kill_grace, &endptr);
+
+        if (*kill_grace == '\0' || *endptr != '\0' ||
+            params->kill_grace < 0) {
+            __limpet_fail("Bad kill grace value\n");
+        }
+    }
+
+    bench_time = __limpet_get_bench_time();
+
+    if (bench_time == NULL) {
+        params->bench_time = __LIMPET_DEFAULT_BENCH_TIME;
+    } else {
+        char *endptr;
+
+        params->bench_time = strtof(bench_time, &endptr);
+
+        if (*bench_time == '\0' || *endptr != '\0' ||
+            !(params->bench_time > 0)) {
+            __limpet_fail("Bad benchmark time value\n");
+        }
+    }
+
+    bench_threshold = __limpet_get_bench_threshold();
+
+    if (bench_threshold == NULL) {
+        params->bench_threshold = __LIMPET_DEFAULT_BENCH_THRESHOLD;
+    } else {
+        char *endptr;
+
+        params->bench_threshold = strtof(bench_threshold, &endptr);
+
+        if (*bench_threshold == '\0' || *endptr != '\0' ||
+            params->bench_threshold < 0) {
+            __limpet_fail("Bad benchmark threshold value\n");
         }
     }
 
+    verbose_env = __limpet_get_verbose();
+    params->verbose = __limpet_parse_bool("VERBOSE", verbose_env, false);
+    params->perf = __limpet_parse_bool("PERF", __limpet_get_perf(), false);
+    params->inproc = __limpet_parse_bool("INPROC", __limpet_get_inproc(),
+        false);
+
+    params->history = __limpet_get_history();
+    params->resources = __limpet_get_resources();
+    params->report = __limpet_get_report();
+    params->rlimits = __limpet_get_rlimits();
+    __limpet_check_rlimits(params->rlimits, "all tests");
+    params->bench_history = __limpet_get_bench_history();
+    params->bench_baseline = __limpet_get_bench_baseline();
+    __limpet_parse_bench_gate(params);
+    __limpet_parse_shards(params);
+
+    __limpet_parse_sysdep_params();
+
     /*
      * Clean up the environment
      */
@@ -247,30 +739,84 @@ static bool __limpet_parse_params(struct __limpet_params *params) {
 }
 
 /*
- * __limpet_list - The linked list of all tests by the per-test
- *      constructors. Tests are added during the test discovery phase by
- *      single-threaded code and removed during the text execution phase.
- *      We're generally multi-threaded then, but only one single thread
- *      function removes tests. So, no mutual exclusion needed.
+ * The beginning and end of the array of pointers to tests in the
+ * __LIMPET_SECTION section. These are weak so that an executable without
+ * any tests still links.
+ */
+extern struct __limpet_test *__start_limpet_tests[] __attribute((weak));
+extern struct __limpet_test *__stop_limpet_tests[] __attribute((weak));
+
+/*
+ * Likewise for the __LIMPET_TEARDOWN_SECTION section
+ */
+extern struct __limpet_teardown *__start_limpet_teardowns[]
+    __attribute((weak));
+extern struct __limpet_teardown *__stop_limpet_teardowns[]
+    __attribute((weak));
+
+/*
+ * __limpet_list - The linked list of all tests, built from the
+ *      __LIMPET_SECTION section before the tests are run. This is done by
+ *      single-threaded code and tests are removed during the text
+ *      execution phase. We're generally multi-threaded then, but only one
+ *      single thread function removes tests. So, no mutual exclusion
+ *      needed.
+ * __limpet_tests - Array of all tests, in the order of the
+ *      __LIMPET_SECTION section, with a test for each row of the table of
+ *      a test defined with LIMPET_TEST_P, or NULL if it hasn't been needed
+ *      yet
+ * __limpet_n_tests - Number of tests in __limpet_tests
+ * __limpet_sorted - Array of all tests, sorted by name, or NULL if it
+ *      hasn't been needed yet
  */
 struct __limpet_test *__limpet_list __attribute((common));
+struct __limpet_test **__limpet_tests __attribute((common));
+size_t __limpet_n_tests __attribute((common));
+struct __limpet_test **__limpet_sorted __attribute((common));
 struct __limpet_test *__limpet_done __attribute((common));
+struct __limpet_test *__limpet_done_tail __attribute((common));
 struct __limpet_mutex __limpet_done_mutex __attribute((common));
 struct __limpet_cond __limpet_done_cond __attribute((common));
 
 /*
- * Add a test to the list of completed tests
+ * Add a test to the end of the list of completed tests, so that tests are
+ * reported in the order in which they completed
  */
 static void __limpet_enqueue_done(struct __limpet_test *test) {
     __limpet_mutex_lock(&__limpet_done_mutex);
 
-    test->done = __limpet_done;
-    __limpet_done = test;
+    test->done = NULL;
+    if (__limpet_done == NULL) {
+        __limpet_done = test;
+    } else {
+        __limpet_done_tail->done = test;
+    }
+    __limpet_done_tail = test;
 
     __limpet_cond_signal(&__limpet_done_cond);
     __limpet_mutex_unlock(&__limpet_done_mutex);
 }
 
+/*
+ * Remove a completed test from the list and return it without waiting.
+ *
+ * Returns: the test, or NULL if no test has completed since the last call
+ */
+static struct __limpet_test *__limpet_try_dequeue_done(void) {
+    struct __limpet_test *test;
+
+    __limpet_mutex_lock(&__limpet_done_mutex);
+
+    test = __limpet_done;
+    if (test != NULL) {
+        __limpet_done = test->done;
+    }
+
+    __limpet_mutex_unlock(&__limpet_done_mutex);
+
+    return test;
+}
+
 /*
  * Wait until a test completes, then remove it from the list and return it
  */
@@ -299,6 +845,8 @@ unsigned __limpet_started __attribute((common));
 unsigned __limpet_passed __attribute((common));
 unsigned __limpet_failed __attribute((common));
 unsigned __limpet_skipped __attribute((common));
+unsigned __limpet_regressed __attribute((common));
+unsigned __limpet_regressed_gated __attribute((common));
 struct __limpet_mutex __limpet_statistics_mutex __attribute((common));
 struct __limpet_cond __limpet_statistics_cond __attribute((common));
 
@@ -358,14 +906,151 @@ static void __limpet_wait_pending(unsigned pending) {
 }
 
 /*
- * Called by per-test constructor to add the test to the test list. This
- * is called in a single threaded context.
+ * Add a test to the test list. This is called in a single threaded
+ * context.
  */
 static void __limpet_enqueue_test(struct __limpet_test *test) {
     test->next = __limpet_list;
     __limpet_list = test;
 }
 
+/*
+ * Fill in the test for one row of the table of a test defined with
+ * LIMPET_TEST_P, from the test registered for the table
+ */
+static void __limpet_make_row(struct __limpet_test *test,
+    struct __limpet_test *pattern, size_t row) {
+    char *name;
+    size_t name_size;
+
+    name_size = strlen(pattern->name) + sizeof("/") + 20;
+    name = (char *)malloc(name_size);
+    if (name == NULL) {
+        __limpet_fail("Out of memory allocating %zu bytes\n", name_size);
+    }
+    snprintf(name, name_size, "%s/%zu", pattern->name, row);
+
+    *test = *pattern;
+    test->name = name;
+    test->row = row;
+}
+
+/*
+ * Build the array of all tests from the __LIMPET_SECTION section, the
+ * first time it is needed. Tests defined with LIMPET_TEST_P are replaced
+ * by a test for each row of their tables.
+ */
+static void __limpet_find_tests(void) {
+    size_t n_entries;
+    size_t n;
+    size_t i;
+
+    if (__limpet_tests != NULL) {
+        return;
+    }
+
+    n_entries = __stop_limpet_tests - __start_limpet_tests;
+    n = 0;
+    for (i = 0; i < n_entries; i++) {
+        struct __limpet_table *table;
+
+        table = __start_limpet_tests[i]->table;
+        n += table == NULL ? 1 : table->rows;
+    }
+
+    __limpet_tests = (struct __limpet_test **)malloc(
+        sizeof(__limpet_tests[0]) * (n + 1));
+    if (__limpet_tests == NULL) {
+        __limpet_fail("Out of memory allocating %zu tests\n", n);
+    }
+
+    n = 0;
+    for (i = 0; i < n_entries; i++) {
+        struct __limpet_test *test;
+        size_t row;
+
+        test = __start_limpet_tests[i];
+        if (test->table == NULL) {
+            __limpet_tests[n++] = test;
+            continue;
+        }
+
+        for (row = 0; row < test->table->rows; row++) {
+            __limpet_make_row(&test->table->tests[row], test, row);
+            __limpet_tests[n++] = &test->table->tests[row];
+        }
+    }
+    __limpet_n_tests = n;
+}
+
+/*
+ * Returns: the number of tests in the executable
+ */
+static size_t __limpet_test_count(void) {
+    __limpet_find_tests();
+    return __limpet_n_tests;
+}
+
+/*
+ * Build the list of tests
+ */
+static void __limpet_register_tests(void) {
+    size_t n;
+    size_t i;
+
+    n = __limpet_test_count();
+    for (i = 0; i < n; i++) {
+        __limpet_enqueue_test(__limpet_tests[i]);
+    }
+}
+
+/*
+ * Compare test names for qsort() and bsearch()
+ */
+static int __limpet_compare_test_names(const void *a, const void *b) {
+    const struct __limpet_test *test_a = *(struct __limpet_test * const *)a;
+    const struct __limpet_test *test_b = *(struct __limpet_test * const *)b;
+
+    return strcmp(test_a->name, test_b->name);
+}
+
+/*
+ * Find a test by name, using a sorted copy of the array of all tests,
+ * which is made the first time it is needed.
+ *
+ * Returns: the test, or NULL if there is no test with this name
+ */
+static struct __limpet_test *__limpet_find_test(const char *name) {
+    struct __limpet_test key_test;
+    struct __limpet_test *key;
+    struct __limpet_test **found;
+    size_t n;
+
+    n = __limpet_test_count();
+
+    if (__limpet_sorted == NULL) {
+        __limpet_sorted = (struct __limpet_test **)malloc(
+            sizeof(__limpet_sorted[0]) * (n + 1));
+        if (__limpet_sorted == NULL) {
+            __limpet_fail("Out of memory allocating %zu tests\n", n);
+        }
+
+        if (n != 0) {
+            memcpy(__limpet_sorted, __limpet_tests,
+                sizeof(__limpet_sorted[0]) * n);
+        }
+        qsort(__limpet_sorted, n, sizeof(__limpet_sorted[0]),
+            __limpet_compare_test_names);
+    }
+
+    key_test.name = name;
+    key = &key_test;
+    found = (struct __limpet_test **)bsearch(&key, __limpet_sorted, n,
+        sizeof(__limpet_sorted[0]), __limpet_compare_test_names);
+
+    return found == NULL ? NULL : *found;
+}
+
 /*
  * Add a test to the list of those to report. Called in a single threaded
  * context.
@@ -383,20 +1068,261 @@ __limpet_next_test(struct __limpet_test * test) {
     return test->next;
 }
 
+/*
+ * Sort the list of tests so that the longest running tests, according to
+ * the history, come first. Tests with no history might take any amount
+ * of time, so they go first of all. This is a merge sort, which keeps
+ * tests with equal durations in the same order as before.
+ */
+static struct __limpet_test *__limpet_sort_by_duration(
+    struct __limpet_test *list) {
+    struct __limpet_test *a;
+    struct __limpet_test *b;
+    struct __limpet_test *slow;
+    struct __limpet_test *fast;
+    struct __limpet_test **tail;
+
+    if (list == NULL || list->next == NULL) {
+        return list;
+    }
+
+    /*
+     * Split the list in half
+     */
+    slow = list;
+    for (fast = list->next; fast != NULL && fast->next != NULL;
+        fast = fast->next->next) {
+        slow = slow->next;
+    }
+    b = slow->next;
+    slow->next = NULL;
+
+    a = __limpet_sort_by_duration(list);
+    b = __limpet_sort_by_duration(b);
+
+    tail = &list;
+    while (a != NULL && b != NULL) {
+        bool a_first;
+
+        if (a->expected_duration < 0) {
+            a_first = true;
+        } else if (b->expected_duration < 0) {
+            a_first = false;
+        } else {
+            a_first = a->expected_duration >= b->expected_duration;
+        }
+
+        if (a_first) {
+            *tail = a;
+            a = a->next;
+        } else {
+            *tail = b;
+            b = b->next;
+        }
+        tail = &(*tail)->next;
+    }
+    *tail = (a != NULL) ? a : b;
+
+    return list;
+}
+
+/*
+ * Pick a shard for a test from its name. Only the low 32 bits of
+ * __limpet_hash_name() are used, so that every machine picks the same
+ * shard whatever the size of size_t. These are mixed with the finalizer
+ * from MurmurHash3, since names like test1 and test2 differ only in the
+ * low bits of their FNV-1a hashes, and the shard is taken from the high
+ * bits.
+ */
+static unsigned __limpet_hash_shard(const char *name, unsigned shard_count) {
+    uint32_t hash;
+
+    hash = (uint32_t)__limpet_hash_name(name);
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+
+    return (unsigned)(((uint64_t)hash * shard_count) >> 32);
+}
+
+/*
+ * Compare tests for qsort() so that the longest comes first. Ties are
+ * broken by name so that every shard sorts the tests the same way.
+ */
+static int __limpet_compare_durations(const void *a, const void *b) {
+    const struct __limpet_test *test_a = *(struct __limpet_test * const *)a;
+    const struct __limpet_test *test_b = *(struct __limpet_test * const *)b;
+
+    if (test_a->expected_duration != test_b->expected_duration) {
+        return test_a->expected_duration > test_b->expected_duration ?
+            -1 : 1;
+    }
+
+    return strcmp(test_a->name, test_b->name);
+}
+
+/*
+ * Returns: true if the test is a benchmark that fails the run if it
+ *      regresses
+ */
+static bool __limpet_bench_gated(struct __limpet_test *test) {
+    return __limpet_pattern_list_match(&test->params->bench_gate, test->name);
+}
+
 static bool __limpet_must_run(const char *name) {
-    size_t i;
+    struct __limpet_runlist *runlist;
 
-    if (__limpet_params.runlist == NULL) {
+    runlist = &__limpet_params.runlist;
+    if (!runlist->given) {
         return true;
     }
 
-    for (i = 0; i < __limpet_params.n_runlist; i++) {
-        if (strcmp(name, __limpet_params.runlist[i]) == 0) {
-            return true;
+    if (__limpet_name_set_contains(&runlist->exclude_names, name) ||
+        __limpet_pattern_list_match(&runlist->exclude_patterns, name)) {
+        return false;
+    }
+
+    if (runlist->n_includes == 0) {
+        return runlist->n_excludes != 0;
+    }
+
+    return __limpet_name_set_contains(&runlist->include_names, name) ||
+        __limpet_pattern_list_match(&runlist->include_patterns, name);
+}
+
+/*
+ * Assign each test to a shard. Every shard makes the same assignment, so
+ * each test is run by exactly one of them, as long as they are all given
+ * the same runlist and, when sharding by duration, the same history.
+ *
+ * When sharding by duration, each test that will be run and has a recorded
+ * duration is given to the shard with the least work so far, longest test
+ * first. Everything else, including tests the runlist skips, is assigned
+ * by hashing its name, so that each skipped test is counted by only one
+ * shard.
+ */
+static void __limpet_assign_shards(void) {
+    struct __limpet_params *params;
+    struct __limpet_test **timed;
+    struct __limpet_test *p;
+    double *loads;
+    size_t n_timed;
+    size_t i;
+
+    params = &__limpet_params;
+    if (params->shard_count == 1) {
+        return;
+    }
+
+    n_timed = 0;
+    timed = NULL;
+    if (params->shard_by == __limpet_shard_by_duration) {
+        timed = (struct __limpet_test **)malloc(sizeof(timed[0]) *
+            (__limpet_test_count() + 1));
+        if (timed == NULL) {
+            __limpet_fail("Out of memory allocating %zu tests\n",
+                __limpet_test_count());
         }
     }
 
-    return false;
+    for (p = __limpet_first_test(); p != NULL; p = __limpet_next_test(p)) {
+        if (timed != NULL && p->expected_duration >= 0 &&
+            __limpet_must_run(p->name)) {
+            timed[n_timed++] = p;
+        } else {
+            p->shard = __limpet_hash_shard(p->name, params->shard_count);
+        }
+    }
+
+    if (timed == NULL) {
+        return;
+    }
+
+    loads = (double *)calloc(params->shard_count, sizeof(loads[0]));
+    if (loads == NULL) {
+        __limpet_fail("Out of memory allocating %u shards\n",
+            params->shard_count);
+    }
+
+    qsort(timed, n_timed, sizeof(timed[0]), __limpet_compare_durations);
+
+    for (i = 0; i < n_timed; i++) {
+        unsigned lightest;
+        unsigned shard;
+
+        lightest = 0;
+        for (shard = 1; shard < params->shard_count; shard++) {
+            if (loads[shard] < loads[lightest]) {
+                lightest = shard;
+            }
+        }
+
+        timed[i]->shard = lightest;
+        loads[lightest] += timed[i]->expected_duration;
+    }
+
+    free(loads);
+    free(timed);
+}
+
+/*
+ * Give each fixture the teardown function defined for it, if any
+ */
+static void __limpet_register_teardowns(void) {
+    struct __limpet_teardown **p;
+
+    for (p = __start_limpet_teardowns; p < __stop_limpet_teardowns; p++) {
+        (*p)->fixture->teardown = (*p)->func;
+    }
+}
+
+/*
+ * Set up the fixtures used by the tests this run will start, counting the
+ * tests that use each one so that it can be torn down when the last of
+ * them completes. This is done before the system-dependent code is
+ * initialized, so that a zygote started then inherits the fixtures, too.
+ * If tests won't inherit them, each test sets up its own fixture instead.
+ */
+static void __limpet_set_up_fixtures(void) {
+    struct __limpet_test *p;
+
+    if (!__limpet_fixtures_inherited()) {
+        return;
+    }
+
+    for (p = __limpet_first_test(); p != NULL; p = __limpet_next_test(p)) {
+        if (p->fixture == NULL ||
+            p->shard != __limpet_params.shard_index ||
+            !__limpet_must_run(p->name)) {
+            continue;
+        }
+
+        if (!p->fixture->set_up) {
+            (*p->fixture->setup)();
+            p->fixture->set_up = true;
+        }
+        p->fixture->pending++;
+    }
+}
+
+/*
+ * Called when a test using a fixture has completed. The fixture is torn
+ * down after the last test using it.
+ */
+static void __limpet_release_fixture(struct __limpet_fixture *fixture) {
+    if (!fixture->set_up) {
+        return;
+    }
+
+    fixture->pending--;
+    if (fixture->pending == 0) {
+        if (fixture->teardown != NULL) {
+            (*fixture->teardown)();
+        }
+        fixture->set_up = false;
+    }
 }
 
 /*
@@ -444,6 +1370,30 @@ static void __limpet_print_test_trailer(struct __limpet_test *test, int n) {
     __limpet_printf("%sTest complete: %s ", __LIMPET_MARKER, test->name);
     __limpet_print_status(test);
     __limpet_printf("\n");
+    __limpet_printf("%sResources: ", __LIMPET_MARKER);
+    __limpet_print_resources(test);
+    __limpet_printf("\n");
+
+    if (test->params->perf && test->results != NULL) {
+        __limpet_printf("%sPerf: ", __LIMPET_MARKER);
+        __limpet_print_perf(&test->results->perf);
+        __limpet_printf("\n");
+    }
+
+    if (__limpet_is_bench(test)) {
+        __limpet_printf("%sBenchmark: ", __LIMPET_MARKER);
+        __limpet_print_bench(&test->results->bench);
+        __limpet_printf("\n");
+    }
+
+    if (__limpet_has_baseline(test)) {
+        __limpet_printf("%sBaseline: ", __LIMPET_MARKER);
+        __limpet_print_baseline(test);
+        if (__limpet_bench_regressed(test) && __limpet_bench_gated(test)) {
+            __limpet_printf(" (gated)");
+        }
+        __limpet_printf("\n");
+    }
 }
 
 /*
@@ -455,34 +1405,299 @@ static void __limpet_print_final_trailer(const char *sep) {
     __limpet_printf("%sRan %u tests: %u passed %u failed %u skipped\n",
         __LIMPET_MARKER, __limpet_started, __limpet_passed, __limpet_failed,
         __limpet_skipped);
+
+    if (__limpet_regressed != 0) {
+        __limpet_printf("%sRegressed %u benchmarks: %u gated %u not gated\n",
+            __LIMPET_MARKER, __limpet_regressed, __limpet_regressed_gated,
+            __limpet_regressed - __limpet_regressed_gated);
+    }
 }
 
 /*
- * Called to print a report on any tests pending in the queue of completed
- * tests.
+ * Print the report for a single completed test
  *
  * Returns: true if it printed something, false otherwise.
  */
-static bool __limpet_report_on_done(size_t *reported, const char *sep) {
+static bool __limpet_report_one(struct __limpet_test *test, const char *sep) {
+    int n;
+
+    __limpet_cleanup_test(test);
+
+    if (test->fixture != NULL) {
+        __limpet_release_fixture(test->fixture);
+    }
+
+    if (__limpet_has_baseline(test) && __limpet_bench_regressed(test)) {
+        __limpet_regressed++;
+        if (__limpet_bench_gated(test)) {
+            __limpet_regressed_gated++;
+        }
+    }
+
+    n = __limpet_pre_stored(test, sep);
+    __limpet_dump_stored_log(test);
+    __limpet_post_stored(test, n);
+    __limpet_report_test(test);
+
+    return n != 0;
+}
+
+/*
+ * Called to print a report on tests in the queue of completed tests.
+ * reported - number of tests reported so far, updated as tests are reported
+ * sep - separator to print before the first report
+ * wait - if false, only report on tests that have already completed and
+ *      return without blocking. If true, wait until every test that has
+ *      been started has been reported.
+ *
+ * Returns: true if it printed something, false otherwise.
+ */
+static bool __limpet_report_on_done(size_t *reported, const char *sep,
+    bool wait) {
     bool printed_something = false;
 
     for (; *reported != __limpet_get_started(); (*reported)++) {
         struct __limpet_test *p;
-        int n;
-
-        p = __limpet_dequeue_done();
-        __limpet_cleanup_test(p);
 
-        n = __limpet_pre_stored(p, sep);
-        printed_something |= (n != 0);
+        if (wait) {
+            p = __limpet_dequeue_done();
+        } else {
+            p = __limpet_try_dequeue_done();
+            if (p == NULL) {
+                break;
+            }
+        }
 
-        __limpet_dump_stored_log(p);
-        __limpet_post_stored(p, n);
+        if (__limpet_report_one(p, sep)) {
+            printed_something = true;
+            sep = __LIMPET_REPORT_SEP;
+        }
     }
 
     return printed_something;
 }
 
+/*
+ * Memory shared with the test processes starts with this header, which is
+ * followed by a struct __limpet_results for each test, in the order of
+ * __limpet_tests
+ * bench_time, perf - the bench_time and perf parameters, for the benefit
+ *      of tests started by the exec strategy, which don't parse the
+ *      configuration
+ */
+struct __limpet_shared {
+    double  bench_time;
+    bool    perf;
+};
+
+static size_t __limpet_shared_size(void) {
+    return sizeof(struct __limpet_shared) +
+        sizeof(struct __limpet_results) * __limpet_test_count();
+}
+
+static struct __limpet_results *__limpet_shared_results(
+    struct __limpet_shared *shared) {
+    return (struct __limpet_results *)(shared + 1);
+}
+
+/*
+ * Give each test a place in memory shared with the test processes to put
+ * its results. This must be done before any process is forked to run
+ * tests.
+ */
+static void __limpet_share_results(void) {
+    struct __limpet_shared *shared;
+    struct __limpet_results *results;
+    size_t n;
+    size_t i;
+
+    shared = (struct __limpet_shared *)__limpet_map_shared(
+        __limpet_shared_size());
+    shared->bench_time = __limpet_params.bench_time;
+    shared->perf = __limpet_params.perf;
+
+    results = __limpet_shared_results(shared);
+    n = __limpet_test_count();
+    for (i = 0; i < n; i++) {
+        __limpet_tests[i]->results = &results[i];
+    }
+}
+
+/*
+ * Running in a process started to run a single test, find the place for
+ * the test's results in the memory shared with the process running the
+ * tests, if it was passed to us
+ */
+static void __limpet_find_results(struct __limpet_test *test) {
+    struct __limpet_shared *shared;
+    size_t n;
+    size_t i;
+
+    __limpet_params.bench_time = __LIMPET_DEFAULT_BENCH_TIME;
+
+    shared = (struct __limpet_shared *)__limpet_get_run_shared(
+        __limpet_shared_size());
+    if (shared == NULL) {
+        return;
+    }
+
+    __limpet_params.bench_time = shared->bench_time;
+    __limpet_params.perf = shared->perf;
+
+    n = __limpet_test_count();
+    for (i = 0; i < n; i++) {
+        if (__limpet_tests[i] == test) {
+            test->results = &__limpet_shared_results(shared)[i];
+        }
+    }
+}
+
+/*
+ * The fixture set up by a test process that didn't inherit it, or NULL
+ */
+static struct __limpet_fixture *__limpet_own_fixture;
+
+static void __limpet_tear_down_own_fixture(void) {
+    if (__limpet_own_fixture->teardown != NULL) {
+        (*__limpet_own_fixture->teardown)();
+    }
+}
+
+/*
+ * Call the function for a test, with its row of the table if it has one
+ */
+static void __limpet_call_func(struct __limpet_test *test) {
+    if (test->table != NULL) {
+        (*test->table->func)(test->row);
+    } else {
+        (*test->func)();
+    }
+}
+
+/*
+ * Running in the context of the process for a test, set it up and run it
+ */
+static void __limpet_call_test(struct __limpet_test *test) {
+    /*
+     * A test started by the exec strategy doesn't inherit its fixture, so
+     * it sets it up itself and tears it down when it exits
+     */
+    if (test->fixture != NULL && !test->fixture->set_up) {
+        (*test->fixture->setup)();
+        test->fixture->set_up = true;
+        __limpet_own_fixture = test->fixture;
+        if (atexit(__limpet_tear_down_own_fixture) != 0) {
+            __limpet_fail("Unable to register fixture teardown\n");
+        }
+    }
+
+    __limpet_apply_rlimits(test);
+    if (test->params->perf) {
+        __limpet_perf_start(test);
+    }
+    __limpet_call_func(test);
+}
+
+/*
+ * Returns: true if the test is to be run in the process running the tests.
+ *      Performance counters and resource limits are for a whole process,
+ *      so if either is wanted, the test gets a process of its own.
+ */
+static bool __limpet_runs_inproc(struct __limpet_test *test) {
+    return test->inproc && test->params->inproc && !test->params->perf &&
+        test->params->rlimits == NULL;
+}
+
+/*
+ * Running in the process running the tests, run a test. If it fails,
+ * __limpet_fail() jumps back here instead of exiting.
+ *
+ * Returns: true if the test passed, false if it failed
+ */
+static bool __limpet_call_inproc(struct __limpet_test *test) {
+    jmp_buf env;
+
+    if (setjmp(env) != 0) {
+        __limpet_inproc_jmp = NULL;
+        return false;
+    }
+
+    __limpet_inproc_jmp = &env;
+    __limpet_call_func(test);
+    __limpet_inproc_jmp = NULL;
+
+    return true;
+}
+
+/*
+ * Run only the named test, in this process, then exit. This is used when
+ * the system-dependent code starts a test by running the test executable
+ * again.
+ */
+static void __limpet_run_named(const char *name) __attribute((noreturn));
+static void __limpet_run_named(const char *name) {
+    struct __limpet_test *test;
+
+    test = __limpet_find_test(name);
+    if (test == NULL) {
+        __limpet_fail("No test named %s\n", name);
+    }
+
+    __limpet_params.rlimits = __limpet_get_run_rlimits();
+    __limpet_find_results(test);
+    __limpet_register_teardowns();
+    __limpet_call_test(test);
+    __limpet_exit(false);
+}
+
+/*
+ * Print a JSON object for each test, one per line, in the order in which
+ * they were defined, then exit. For example:
+ *  {"name":"simple_good","file":"simple.cc","line":31,"tags":["slow"]}
+ * Nothing is run, so this is quick even for large test executables.
+ */
+static void __limpet_print_test_list(void) __attribute((noreturn));
+static void __limpet_print_test_list(void) {
+    size_t n;
+    size_t i;
+
+    n = __limpet_test_count();
+    for (i = 0; i < n; i++) {
+        struct __limpet_test *test;
+        const char *tag;
+        const char *sep;
+
+        test = __limpet_tests[i];
+
+        __limpet_printf("{\"name\":");
+        __limpet_fprint_json_string(stdout, test->name,
+            strlen(test->name));
+        __limpet_printf(",\"file\":");
+        __limpet_fprint_json_string(stdout, test->file,
+            strlen(test->file));
+        __limpet_printf(",\"line\":%u,\"tags\":[", test->line);
+
+        sep = "";
+        for (tag = test->tags; tag != NULL && *tag != '\0';) {
+            size_t len;
+
+            len = strcspn(tag, " ");
+            if (len != 0) {
+                __limpet_printf("%s", sep);
+                __limpet_fprint_json_string(stdout, tag, len);
+                sep = ",";
+            }
+
+            tag += len;
+            tag += strspn(tag, " ");
+        }
+
+        __limpet_printf("]}\n");
+    }
+
+    __limpet_exit(false);
+}
+
 /*
  * This is the function that runs all the tests in the file including this
  * header file. There will actually be one of these in each file #including
@@ -494,13 +1709,48 @@ static void __limpet_run(void) \
 static void __limpet_run(void) {
     struct __limpet_test *p;
     const char *sep;
+    const char *run_one;
     size_t reported;
 
+    run_one = __limpet_get_run_one();
+    if (run_one != NULL) {
+        __limpet_run_named(run_one);
+    }
+
+    if (__limpet_parse_bool("LIST", __limpet_get_list(), false)) {
+        __limpet_print_test_list();
+    }
+
     __limpet_printf("Running limpet\n");
+    __limpet_register_tests();
     __limpet_mutex_init(&__limpet_statistics_mutex);
     __limpet_cond_init(&__limpet_statistics_cond);
     __limpet_parse_params(&__limpet_params);
 
+    /*
+     * If we know how long tests took last time, start the longest ones
+     * first so that they don't stretch out the end of the run
+     */
+    if (__limpet_params.history != NULL) {
+        __limpet_read_history(__limpet_params.history);
+        __limpet_list = __limpet_sort_by_duration(__limpet_list);
+    }
+
+    if (__limpet_params.bench_history != NULL) {
+        __limpet_read_bench_history(__limpet_params.bench_history,
+            __limpet_params.bench_baseline);
+    }
+
+    __limpet_assign_shards();
+    __limpet_register_teardowns();
+    __limpet_set_up_fixtures();
+    __limpet_share_results();
+    __limpet_sysdep_init();
+
+    if (__limpet_params.report != NULL) {
+        __limpet_open_reports(__limpet_params.report);
+    }
+
     sep = "";
     reported = 0;
 
@@ -508,9 +1758,20 @@ static void __limpet_run(void) {
         p = __limpet_next_test(p)) {
         int n;
 
+        /*
+         * Tests belonging to other shards are left to them, and not
+         * counted here at all. They are marked as skipped so that their
+         * history is kept.
+         */
+        if (p->shard != __limpet_params.shard_index) {
+            p->skipped = true;
+            continue;
+        }
+
         if (!__limpet_must_run(p->name)) {
             p->skipped = true;
             __limpet_inc_skipped();
+            __limpet_report_test(p);
             continue;
         }
 
@@ -522,22 +1783,32 @@ static void __limpet_run(void) {
             __limpet_wait_pending(__limpet_params.max_jobs);
         }
 
+        if (p->rlimits != NULL) {
+            __limpet_check_rlimits(p->rlimits, p->name);
+        }
+
         __limpet_inc_started();
 
+        p->start_time = __limpet_now();
         n = __limpet_pre_start( p, sep);
         if (n != 0) {
             sep = __LIMPET_REPORT_SEP;
         }
 
-        __limpet_start_one(p);
+        if (__limpet_runs_inproc(p)) {
+            __limpet_start_inproc(p);
+        } else {
+            __limpet_start_one(p);
+        }
 
         __limpet_post_start(p, n);
 
         /*
-         * Keep resource usage to a minimum by doing reporting here. It
-         * doesn't need to be exact, so no fancy sychronization.
+         * Report on whatever has finished so far, but don't wait for
+         * anything else to finish. Waiting here would keep more than one
+         * test from running at a time.
          */
-        if (__limpet_report_on_done(&reported, sep)) {
+        if (__limpet_report_on_done(&reported, sep, false)) {
             sep = __LIMPET_REPORT_SEP;
         }
     }
@@ -546,13 +1817,31 @@ static void __limpet_run(void) {
      * All tests have been started. Print reports for any that haven't
      * been reported.
      */
-    if (__limpet_report_on_done(&reported, sep)) {
+    if (__limpet_report_on_done(&reported, sep, true)) {
         sep = __LIMPET_REPORT_SEP;
     }
 
+    if (__limpet_params.history != NULL) {
+        __limpet_write_history(__limpet_params.history);
+    }
+
+    if (__limpet_params.bench_history != NULL) {
+        __limpet_write_bench_history(__limpet_params.bench_history);
+    }
+
+    if (__limpet_params.resources != NULL) {
+        __limpet_write_resources(__limpet_params.resources);
+    }
+
+    __limpet_close_reports();
+
     __limpet_print_final_trailer(sep);
 
-    __limpet_exit(__limpet_failed != 0);
+    /*
+     * A gated benchmark that regressed fails the run even though the test
+     * itself passed
+     */
+    __limpet_exit(__limpet_failed != 0 || __limpet_regressed_gated != 0);
 }
 #endif /* LIMPET */
 #endif /* _LEAVEIN_H_ */
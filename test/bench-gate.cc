@@ -0,0 +1,63 @@
+/*
+ * Test for benchmark regression gating. The baselines are in
+ * test/bench-gate.history, which is copied to where LIMPET_BENCH_HISTORY
+ * points, and are picked out with LIMPET_BENCH_BASELINE. They are either
+ * far faster or far slower than any real run, so whether each benchmark
+ * regressed doesn't depend on how fast this machine is.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <limpet.h>
+
+int main(int argc, char *argv[]) {
+    fprintf(stderr, "Should never get to main()\n");
+    exit(EXIT_FAILURE);
+}
+
+#ifdef LIMPET
+/*
+ * Regresses and is gated, so the run fails
+ */
+LIMPET_BENCH(bench_gated) {
+    unsigned x = 1;
+
+    LIMPET_BENCH_LOOP {
+        limpet_do_not_optimize(x * 3 + 1);
+    }
+}
+
+/*
+ * Regresses, but is only reported
+ */
+LIMPET_BENCH(bench_not_gated) {
+    unsigned x = 1;
+
+    LIMPET_BENCH_LOOP {
+        limpet_do_not_optimize(x * 3 + 1);
+    }
+}
+
+/*
+ * Gated, but faster than its baseline
+ */
+LIMPET_BENCH(bench_faster) {
+    unsigned x = 1;
+
+    LIMPET_BENCH_LOOP {
+        limpet_do_not_optimize(x * 3 + 1);
+    }
+}
+
+/*
+ * Has no baseline to compare with
+ */
+LIMPET_BENCH(bench_new) {
+    unsigned x = 1;
+
+    LIMPET_BENCH_LOOP {
+        limpet_do_not_optimize(x * 3 + 1);
+    }
+}
+#endif /* LIMPET */
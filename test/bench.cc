@@ -0,0 +1,69 @@
+/*
+ * Test for benchmarks. The times vary from run to run, so they are printed
+ * after the test status, where only the words around them are compared
+ * with the expected output. This is built with optimization, as real
+ * benchmarks would be, so that a loop that does nothing is deleted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <limpet.h>
+
+int main(int argc, char *argv[]) {
+    fprintf(stderr, "Should never get to main()\n");
+    exit(EXIT_FAILURE);
+}
+
+#ifdef LIMPET
+LIMPET_BENCH(bench_add) {
+    unsigned x = 1;
+
+    LIMPET_BENCH_LOOP {
+        limpet_do_not_optimize(x * 3 + 1);
+    }
+}
+
+/*
+ * Values too large for a register, such as structs, can be kept too
+ */
+struct point {
+    double x;
+    double y;
+    double z;
+};
+
+LIMPET_BENCH(bench_struct) {
+    struct point p = {1, 2, 3};
+
+    LIMPET_BENCH_LOOP {
+        p.x += p.y * p.z;
+        limpet_do_not_optimize(p);
+    }
+}
+
+LIMPET_BENCH(bench_memset) {
+    char buf[256];
+
+    LIMPET_BENCH_LOOP {
+        memset(buf, 0, sizeof(buf));
+        limpet_clobber_memory();
+    }
+}
+
+LIMPET_BENCH(bench_no_loop) {
+}
+
+/*
+ * Nothing is done with the result, so the optimizer deletes the whole loop
+ * and it never takes any longer however many times it is meant to run
+ */
+LIMPET_BENCH(bench_optimized_away) {
+    unsigned x = 1;
+
+    LIMPET_BENCH_LOOP {
+        x = x * 3 + 1;
+    }
+}
+#endif /* LIMPET */
@@ -0,0 +1,83 @@
+/*
+ * Test for fixtures, which are set up once in the process running the
+ * tests and inherited by each test that uses them
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <limpet.h>
+
+int main(int argc, char *argv[]) {
+    fprintf(stderr, "Should never get to main()\n");
+    exit(EXIT_FAILURE);
+}
+
+#ifdef LIMPET
+#define N_SQUARES   1000
+
+/*
+ * Set up by the squares fixture
+ * squares - table of the squares of 0 to N_SQUARES - 1
+ * squares_pid - process that set up the table
+ */
+static unsigned *squares;
+static pid_t squares_pid;
+
+LIMPET_FIXTURE(squares) {
+    unsigned i;
+
+    squares = (unsigned *)malloc(N_SQUARES * sizeof(squares[0]));
+    limpet_assert(squares != NULL);
+
+    for (i = 0; i < N_SQUARES; i++) {
+        squares[i] = i * i;
+    }
+
+    squares_pid = getpid();
+}
+
+LIMPET_FIXTURE_TEARDOWN(squares) {
+    free(squares);
+    squares = NULL;
+}
+
+/*
+ * Has no teardown
+ */
+static const char *greeting;
+
+LIMPET_FIXTURE(greeting) {
+    greeting = "hello";
+}
+
+LIMPET_TEST_F(squares, fixture_inherited) {
+    limpet_assert(squares != NULL);
+    limpet_assert_ne(squares_pid, getpid());
+    printf("This is printed by test %s\n", __func__);
+}
+
+LIMPET_TEST_F(squares, fixture_values) {
+    limpet_assert_eq(squares[0], 0u);
+    limpet_assert_eq(squares[2], 4u);
+    limpet_assert_eq(squares[N_SQUARES - 1],
+        (unsigned)(N_SQUARES - 1) * (N_SQUARES - 1));
+    printf("This is printed by test %s\n", __func__);
+}
+
+/*
+ * Each test has its own copy of the fixture, so fixture_values doesn't see
+ * this change
+ */
+LIMPET_TEST_F(squares, fixture_private) {
+    squares[2] = 5;
+    limpet_assert_eq(squares[2], 5u);
+    printf("This is printed by test %s\n", __func__);
+}
+
+LIMPET_TEST_F(greeting, fixture_no_teardown) {
+    limpet_assert(greeting != NULL);
+    printf("This is printed by test %s: %s\n", __func__, greeting);
+}
+#endif /* LIMPET */
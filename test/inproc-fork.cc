@@ -0,0 +1,60 @@
+/*
+ * Test for children of a test run in the process running the tests. The
+ * last test runs there, starting and waiting for one child after another,
+ * while the tests with processes of their own exit one by one. Each child
+ * must be left for the test to wait for, rather than being reaped with
+ * what the other tests leave behind.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <limpet.h>
+
+int main(int argc, char *argv[]) {
+    fprintf(stderr, "Should never get to main()\n");
+    exit(EXIT_FAILURE);
+}
+
+#ifdef LIMPET
+/*
+ * Number of children started by the test run in process
+ */
+#define CHILDREN    100
+
+LIMPET_TEST_INPROC(inproc_fork) {
+    unsigned i;
+
+    for (i = 0; i < CHILDREN; i++) {
+        pid_t pid;
+        int status;
+
+        pid = fork();
+        limpet_assert(pid != -1);
+        if (pid == 0) {
+            _exit(EXIT_SUCCESS);
+        }
+
+        /*
+         * Give the child time to exit, so that it is waiting to be reaped
+         * when the other tests do
+         */
+        usleep(1000);
+        limpet_assert_eq(waitpid(pid, &status, 0), pid);
+        limpet_assert(WIFEXITED(status));
+    }
+}
+
+/*
+ * Milliseconds for which each test with a process of its own sleeps, so
+ * that they exit at different times while the test above runs
+ */
+static const unsigned sleeps[] = { 10, 20, 30, 40, 50, 60, 70 };
+
+LIMPET_TEST_P(fork_sleep, sleeps) {
+    usleep(limpet_param * 1000);
+}
+#endif /* LIMPET */
@@ -0,0 +1,69 @@
+/*
+ * Test for tests run in the process running the tests. Those defined with
+ * LIMPET_TEST_INPROC run there, one of them failing, while the others still
+ * get processes of their own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <limpet.h>
+
+int main(int argc, char *argv[]) {
+    fprintf(stderr, "Should never get to main()\n");
+    exit(EXIT_FAILURE);
+}
+
+#ifdef LIMPET
+/*
+ * Environment variable in which the process running the tests leaves its
+ * process ID
+ */
+#define RUNNER_PID  "INPROC_RUNNER_PID"
+
+/*
+ * The process running the tests, found before the tests are run. A test
+ * executable run again by LIMPET_SPAWN=exec inherits our environment, so it
+ * finds the process ID there rather than taking its own.
+ */
+static pid_t runner_pid;
+
+static void find_runner(void) __attribute((constructor(__LIMPET_RUN_PRI - 1)));
+static void find_runner(void) {
+    const char *runner;
+    char pid[32];
+
+    runner = getenv(RUNNER_PID);
+    if (runner != NULL) {
+        runner_pid = atoi(runner);
+        return;
+    }
+
+    runner_pid = getpid();
+    snprintf(pid, sizeof(pid), "%d", runner_pid);
+    setenv(RUNNER_PID, pid, 1);
+}
+
+LIMPET_TEST_INPROC(inproc_pass) {
+    limpet_assert_eq(getpid(), runner_pid);
+    printf("This is printed by test %s\n", __func__);
+}
+
+LIMPET_TEST_INPROC(inproc_fail) {
+    printf("This is printed by test %s\n", __func__);
+    fprintf(stderr, "This is printed to stderr by test %s\n", __func__);
+    limpet_assert_eq(1, 2);
+    printf("This should not be printed by test %s\n", __func__);
+}
+
+LIMPET_TEST_INPROC(inproc_after_fail) {
+    limpet_assert_eq(getpid(), runner_pid);
+    printf("This is printed by test %s\n", __func__);
+}
+
+LIMPET_TEST(own_process) {
+    limpet_assert_ne(getpid(), runner_pid);
+    printf("This is printed by test %s\n", __func__);
+}
+#endif /* LIMPET */
@@ -0,0 +1,31 @@
+/*
+ * Test for the limit on the output kept for each test. One test writes
+ * more than the limit, so only the start and end of its output are kept,
+ * and the other writes less, so all of its output is kept.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <limpet.h>
+
+int main(int argc, char *argv[]) {
+    fprintf(stderr, "Should never get to main()\n");
+    exit(EXIT_FAILURE);
+}
+
+#ifdef LIMPET
+LIMPET_TEST(over_limit) {
+    unsigned i;
+
+    for (i = 0; i < 100; i++) {
+        printf("line %03u\n", i);
+    }
+    limpet_assert_eq(1, 2);
+}
+
+LIMPET_TEST(under_limit) {
+    printf("This is printed by test %s\n", __func__);
+    limpet_assert_eq(1, 2);
+}
+#endif /* LIMPET */
@@ -0,0 +1,98 @@
+/*
+ * Test for processes left behind by a test outside its process group. The
+ * first test leaves a process in a session of its own, which exits after
+ * the test does, the second runs until it has exited and the last checks
+ * that it was reaped rather than left a zombie of the process running the
+ * tests. The tests must be run one at a time, in that order.
+ */
+
+#include <sys/types.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <limpet.h>
+
+int main(int argc, char *argv[]) {
+    fprintf(stderr, "Should never get to main()\n");
+    exit(EXIT_FAILURE);
+}
+
+#ifdef LIMPET
+/*
+ * Count the children of a process that are zombies in a session of their
+ * own
+ */
+static unsigned count_orphans(pid_t parent) {
+    char path[64];
+    unsigned n = 0;
+    struct dirent *entry;
+    DIR *dp;
+
+    snprintf(path, sizeof(path), "/proc/%d/task", parent);
+    dp = opendir(path);
+    limpet_assert(dp != NULL);
+
+    while ((entry = readdir(dp)) != NULL) {
+        FILE *fp;
+        int child;
+
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "/proc/%d/task/%d/children", parent,
+            atoi(entry->d_name));
+        fp = fopen(path, "r");
+        if (fp == NULL) {
+            continue;
+        }
+
+        while (fscanf(fp, "%d", &child) == 1) {
+            char stat_path[64];
+            char state;
+            int session;
+            FILE *stat_fp;
+
+            snprintf(stat_path, sizeof(stat_path), "/proc/%d/stat", child);
+            stat_fp = fopen(stat_path, "r");
+            if (stat_fp == NULL) {
+                continue;
+            }
+            if (fscanf(stat_fp, "%*d (%*[^)]) %c %*d %*d %d", &state,
+                &session) == 2 && state == 'Z' && session == child) {
+                n++;
+            }
+            fclose(stat_fp);
+        }
+
+        fclose(fp);
+    }
+
+    closedir(dp);
+
+    return n;
+}
+
+LIMPET_TEST(orphan_reaped) {
+    limpet_assert_eq(count_orphans(getppid()), 0);
+}
+
+LIMPET_TEST(orphan_outlived) {
+    usleep(200000);
+}
+
+LIMPET_TEST(orphan_left) {
+    pid_t pid;
+
+    pid = fork();
+    limpet_assert(pid != -1);
+    if (pid == 0) {
+        setsid();
+        usleep(50000);
+        _exit(EXIT_SUCCESS);
+    }
+}
+#endif /* LIMPET */
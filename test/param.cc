@@ -0,0 +1,57 @@
+/*
+ * Test for tests run once for each row of a table. LIMPET_RUNLIST selects
+ * all the rows of one table, but only some of the other.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <limpet.h>
+
+int main(int argc, char *argv[]) {
+    fprintf(stderr, "Should never get to main()\n");
+    exit(EXIT_FAILURE);
+}
+
+#ifdef LIMPET
+static const unsigned sizes[] = { 0, 1, 17, 200 };
+
+/*
+ * Sum the first limpet_param numbers by adding them and with the formula
+ */
+LIMPET_TEST_P(sum, sizes) {
+    unsigned long total;
+    unsigned i;
+
+    total = 0;
+    for (i = 0; i < limpet_param; i++) {
+        total += i;
+    }
+
+    printf("Sum of the first %u numbers is %lu\n", limpet_param, total);
+    limpet_assert_eq(total * 2, (unsigned long)limpet_param *
+        (limpet_param - 1));
+}
+
+struct length_case {
+    const char  *s;
+    size_t      len;
+};
+
+/*
+ * The third row is wrong, so that test fails while the others pass
+ */
+static const struct length_case lengths[] = {
+    { "", 0 },
+    { "limpet", 6 },
+    { "four", 5 },
+    { "not run", 7 },
+};
+
+LIMPET_TEST_P(length, lengths) {
+    printf("Length of \"%s\" should be %zu\n", limpet_param.s,
+        limpet_param.len);
+    limpet_assert_eq(strlen(limpet_param.s), limpet_param.len);
+}
+#endif /* LIMPET */
@@ -0,0 +1,85 @@
+/*
+ * Test for performance counters. Every test must be counted however it
+ * ends, but the counts vary from run to run, so only the names of the
+ * software counters, which every machine has, are checked.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <limpet.h>
+
+#include <sys/wait.h>
+
+int main(int argc, char *argv[]) {
+    fprintf(stderr, "Should never get to main()\n");
+    exit(EXIT_FAILURE);
+}
+
+#ifdef LIMPET
+LIMPET_TEST(perf_memory) {
+    size_t size = 16 * 1024 * 1024;
+    char *p;
+
+    p = (char *)malloc(size);
+    limpet_assert(p != NULL);
+    memset(p, 1, size);
+    printf("This is printed by test %s\n", __func__);
+    free(p);
+}
+
+/*
+ * The counters are inherited by processes the test starts
+ */
+LIMPET_TEST(perf_child) {
+    pid_t pid;
+    int status;
+
+    pid = fork();
+    limpet_assert(pid != -1);
+    if (pid == 0) {
+        _exit(EXIT_SUCCESS);
+    }
+
+    limpet_assert_eq(waitpid(pid, &status, 0), pid);
+    limpet_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    printf("This is printed by test %s\n", __func__);
+}
+
+/*
+ * The counters are still read when an assertion fails
+ */
+LIMPET_TEST(perf_failure) {
+    printf("This is printed by test %s\n", __func__);
+    limpet_assert_eq(1, 2);
+}
+
+/*
+ * The counters are read by the process running the tests, so they are
+ * there for a test process that was killed, exited without running its
+ * exit handlers or timed out
+ */
+LIMPET_TEST(perf_signal) {
+    printf("This is printed by test %s\n", __func__);
+    fflush(stdout);
+    raise(SIGKILL);
+}
+
+LIMPET_TEST(perf_exit) {
+    printf("This is printed by test %s\n", __func__);
+    fflush(stdout);
+    _exit(EXIT_SUCCESS);
+}
+
+LIMPET_TEST(perf_timeout) {
+    volatile unsigned long n;
+
+    printf("This is printed by test %s\n", __func__);
+    fflush(stdout);
+    for (n = 0; ; n++) {
+    }
+}
+#endif /* LIMPET */
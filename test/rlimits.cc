@@ -0,0 +1,68 @@
+/*
+ * Test for resource limits given for all tests and for a single test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <limpet.h>
+
+#include <sys/resource.h>
+#include <errno.h>
+#include <fcntl.h>
+
+int main(int argc, char *argv[]) {
+    fprintf(stderr, "Should never get to main()\n");
+    exit(EXIT_FAILURE);
+}
+
+#ifdef LIMPET
+/*
+ * LIMPET_RLIMITS gives a limit of 32 open files for all tests
+ */
+LIMPET_TEST(all_tests_limit) {
+    struct rlimit rlim;
+
+    limpet_assert_eq(getrlimit(RLIMIT_NOFILE, &rlim), 0);
+    limpet_assert_eq(rlim.rlim_cur, (rlim_t)32);
+    printf("This is printed by test %s\n", __func__);
+}
+
+LIMPET_TEST_RLIMITS(nofile_limit, "nofile=16") {
+    int n;
+
+    for (n = 0; open("/dev/null", O_RDONLY) != -1; n++) {
+    }
+
+    limpet_assert_eq(errno, EMFILE);
+    limpet_assert_lt(n, 16);
+    printf("This is printed by test %s\n", __func__);
+}
+
+LIMPET_TEST_RLIMITS(as_limit, "as=256M") {
+    limpet_assert(malloc(512 * 1024 * 1024) == NULL);
+    printf("This is printed by test %s\n", __func__);
+}
+
+LIMPET_TEST_RLIMITS(fsize_limit, "fsize=4K core=0") {
+    static char buf[8 * 1024];
+    FILE *fp;
+
+    fp = tmpfile();
+    limpet_assert(fp != NULL);
+    printf("This is printed by test %s\n", __func__);
+    fflush(stdout);
+    fwrite(buf, 1, sizeof(buf), fp);
+    fflush(fp);
+}
+
+LIMPET_TEST_RLIMITS(cpu_limit, "cpu=1 core=0") {
+    volatile unsigned long n;
+
+    printf("This is printed by test %s\n", __func__);
+    fflush(stdout);
+    for (n = 0; ; n++) {
+    }
+}
+#endif /* LIMPET */
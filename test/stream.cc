@@ -0,0 +1,32 @@
+/*
+ * Test for output streamed as tests write it. The lines of each test are
+ * printed with its name, and the log of the test that fails is printed
+ * again once it completes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <limpet.h>
+
+int main(int argc, char *argv[]) {
+    fprintf(stderr, "Should never get to main()\n");
+    exit(EXIT_FAILURE);
+}
+
+#ifdef LIMPET
+LIMPET_TEST(stream_pass) {
+    printf("This is printed by test %s\n", __func__);
+    printf("\n");
+    printf("    This line is indented\n");
+    fflush(stdout);
+    fprintf(stderr, "This is printed to stderr by test %s\n", __func__);
+}
+
+LIMPET_TEST(stream_fail) {
+    printf("This is printed by test %s\n", __func__);
+    printf("This line has no newline");
+    fflush(stdout);
+    limpet_assert_eq(1, 2);
+}
+#endif /* LIMPET */
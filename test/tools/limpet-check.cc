@@ -0,0 +1,785 @@
+/*
+ * Parse the output of limpet tests and check it against the expected
+ * output. This does the work of the parse-test and check-tests scripts
+ * that used to be used, in a single pass over the output:
+ *
+ *  limpet-check parse test-name out-dir
+ *      Read the output of a test executable from stdin and write the log
+ *      of each test to out-dir/test-name.<name of test> and the summary,
+ *      along with any lines that follow it, to out-dir/test-name.summary.
+ *      The resources, performance counters and benchmark results printed
+ *      after the status of a test are written to its log with each figure
+ *      replaced by "N", since they differ from run to run. The hardware
+ *      counters are left out, since only some machines have them.
+ *      Lines streamed with LIMPET_STREAM are written, without the time at
+ *      which they were printed, to out-dir/test-name.stream, grouped by
+ *      test so that the order in which tests ran doesn't matter. The list
+ *      printed instead of running the tests when LIMPET_LIST is true is
+ *      written to out-dir/test-name.list.
+ *
+ *  limpet-check check [-v] out-dir "test-list"
+ *      Compare the files written for each test executable in test-list
+ *      with those in test/canonical. Files are compared by size and hash
+ *      and only if they differ is diff run, when -v is given, to show how.
+ *      Files ending in .tsv are tables of figures that differ from run to
+ *      run, such as those written by LIMPET_RESOURCES, so each field that
+ *      is a number is replaced by "N" before they are compared. Files
+ *      ending in .jsonl, .tap and .xml are reports written by LIMPET_REPORT,
+ *      in which the times and resource usage are replaced by "N" and the
+ *      current directory, which is part of the name of the test executable,
+ *      is removed.
+ */
+
+#include <sys/types.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#define CANONICAL   "test/canonical"
+
+/*
+ * Size of the buffers used to read files being compared
+ */
+#define READ_SIZE   (64 * 1024)
+
+static void usage(void) {
+    fprintf(stderr, "usage: limpet-check parse test-name out-dir\n"
+        "       limpet-check check [-v] out-dir \"test-list\"\n");
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Read a line the way the shell's read builtin does, since the expected
+ * output was produced that way: leading and trailing spaces and tabs are
+ * dropped, a backslash quotes the character after it and a backslash at
+ * the end of a line joins it to the next. Like read, a last line with no
+ * newline is not returned.
+ *
+ * Returns: true if a line was read, false at end of file
+ */
+static bool read_line(FILE *fp, std::string &line) {
+    static char *buf;
+    static size_t buf_size;
+    ssize_t len;
+    bool got_line = false;
+    bool more = true;
+
+    line.clear();
+
+    while (more && (len = getline(&buf, &buf_size, fp)) != -1) {
+        size_t i;
+
+        if (len == 0 || buf[len - 1] != '\n') {
+            break;
+        }
+        len--;
+
+        more = false;
+        if (memchr(buf, '\\', len) == NULL) {
+            line.append(buf, len);
+            got_line = true;
+            break;
+        }
+
+        for (i = 0; i < (size_t)len; i++) {
+            if (buf[i] != '\\') {
+                line += buf[i];
+            } else if (i + 1 == (size_t)len) {
+                more = true;
+            } else {
+                i++;
+                line += buf[i];
+            }
+        }
+        got_line = !more;
+    }
+
+    if (got_line) {
+        size_t start;
+        size_t end;
+
+        start = line.find_first_not_of(" \t");
+        if (start == std::string::npos) {
+            line.clear();
+        } else {
+            end = line.find_last_not_of(" \t");
+            line = line.substr(start, end - start + 1);
+        }
+    }
+
+    return got_line;
+}
+
+static bool starts_with(const std::string &s, const char *prefix) {
+    return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+/*
+ * Returns: true if the line is made of the given prefix followed by one or
+ *      more of the character c, such as "> vvvv"
+ */
+static bool is_rule(const std::string &line, const char *prefix, char c) {
+    size_t len = strlen(prefix);
+
+    return starts_with(line, prefix) && line.size() > len &&
+        line.find_first_not_of(c, len) == std::string::npos;
+}
+
+/*
+ * We expect every line to start with "> " as output from the limpet test
+ * framework. If not, we don't know what to do with it.
+ */
+static void check_for_unexpected(const std::string &line) {
+    if (!starts_with(line, "> ")) {
+        fprintf(stderr, "Input is not from limpet: %s\n", line.c_str());
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Lines that can follow "> Test complete:" in the log of a test
+ */
+static const char *trailers[] = {
+    "> Resources: ", "> Perf: ", "> Benchmark: ", "> Baseline: ",
+};
+
+static bool is_trailer(const std::string &line) {
+    for (const char *trailer : trailers) {
+        if (starts_with(line, trailer)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Performance counters that only some machines can count, which are
+ * dropped from "> Perf:" lines
+ */
+static const char *hardware_counters[] = {
+    "instructions=", "cycles=", "cache_misses=",
+};
+
+/*
+ * Remove the hardware counters from a "> Perf:" line
+ */
+static std::string drop_hardware_counters(const std::string &line) {
+    std::string kept = "> Perf:";
+    size_t start;
+
+    for (start = kept.size() + 1; start < line.size(); ) {
+        size_t end = line.find(' ', start);
+        std::string field;
+        bool hardware = false;
+
+        if (end == std::string::npos) {
+            end = line.size();
+        }
+        field = line.substr(start, end - start);
+        for (const char *counter : hardware_counters) {
+            hardware = hardware || starts_with(field, counter);
+        }
+        if (!hardware) {
+            kept += " " + field;
+        }
+        start = end + 1;
+    }
+
+    return kept;
+}
+
+/*
+ * Replace each number in a line that starts a word, such as the 1.5 of
+ * "wall=1.5s" or the 1e-06 of "median 1e-06 ns/op", with "N"
+ */
+static std::string mask_figures(const std::string &line) {
+    std::string masked;
+    size_t i;
+
+    for (i = 0; i < line.size(); ) {
+        size_t end;
+
+        if (!isdigit((unsigned char)line[i]) ||
+            (i != 0 && isalnum((unsigned char)line[i - 1]))) {
+            masked += line[i++];
+            continue;
+        }
+
+        end = line.find_first_not_of("0123456789.", i);
+        if (end != std::string::npos && line[end] == 'e' &&
+            end + 2 < line.size() &&
+            (line[end + 1] == '+' || line[end + 1] == '-') &&
+            isdigit((unsigned char)line[end + 2])) {
+            end = line.find_first_not_of("0123456789", end + 2);
+        }
+        if (end == std::string::npos) {
+            end = line.size();
+        }
+
+        masked += "N";
+        i = end;
+    }
+
+    return masked;
+}
+
+/*
+ * Streamed output looks like "[test-name +1.234s] text". Get the name of
+ * the test and the text.
+ *
+ * Returns: true if the line is streamed output, false otherwise
+ */
+static bool parse_stream_line(const std::string &line, std::string &name,
+    std::string &text) {
+    size_t close;
+    size_t plus;
+
+    if (!starts_with(line, "[")) {
+        return false;
+    }
+
+    close = line.find("s]");
+    if (close == std::string::npos) {
+        return false;
+    }
+
+    plus = line.rfind(" +", close);
+    if (plus == std::string::npos || plus < 2 || plus + 2 == close ||
+        line.find_first_not_of("0123456789.", plus + 2) != close) {
+        return false;
+    }
+
+    name = line.substr(1, plus - 1);
+    text = close + 3 < line.size() ? line.substr(close + 3) : "";
+
+    return true;
+}
+
+/*
+ * Get the name of the file for the log of a test. The names of tests run
+ * for each row of a table have a '/', which is replaced with a '.' so the
+ * file is in the output directory like the rest.
+ */
+static std::string log_file_name(const std::string &test_name) {
+    std::string name = test_name;
+
+    for (char &c : name) {
+        if (c == '/') {
+            c = '.';
+        }
+    }
+
+    return name;
+}
+
+static FILE *open_output(const std::string &path) {
+    FILE *fp;
+
+    fp = fopen(path.c_str(), "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Unable to create %s: %s\n", path.c_str(),
+            strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    return fp;
+}
+
+static void close_output(FILE *fp, const std::string &path) {
+    if (fp != NULL && fclose(fp) != 0) {
+        fprintf(stderr, "Unable to write %s: %s\n", path.c_str(),
+            strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void write_line(FILE *fp, const std::string &line) {
+    fwrite(line.data(), 1, line.size(), fp);
+    fputc('\n', fp);
+}
+
+enum parse_state {
+    scanning_for_start,
+    scanning_for_name,
+    scanning_for_log,
+    scanning_log,
+    scanning_for_status,
+    scanning_for_sep,
+    scanning_for_end,
+};
+
+static const char *state_names[] = {
+    "scanning_for_start",
+    "scanning_for_name",
+    "scanning_for_log",
+    "scanning_log",
+    "scanning_for_status",
+    "scanning_for_sep",
+    "scanning_for_end",
+};
+
+/*
+ * Write the streamed output of each test, in order of the test names
+ */
+static void write_streams(const std::string &path,
+    const std::map<std::string, std::vector<std::string>> &streams) {
+    FILE *fp;
+
+    if (streams.empty()) {
+        return;
+    }
+
+    fp = open_output(path);
+    for (const auto &stream : streams) {
+        for (const std::string &text : stream.second) {
+            write_line(fp, stream.first + ":" +
+                (text.empty() ? "" : " " + text));
+        }
+    }
+    close_output(fp, path);
+}
+
+static int parse(const char *file_name, const char *out_dir) {
+    enum parse_state state = scanning_for_start;
+    std::string prefix = std::string(out_dir) + "/" + file_name + ".";
+    std::map<std::string, std::vector<std::string>> streams;
+    std::string output;
+    std::string line;
+    std::string name;
+    std::string text;
+    bool listed = false;
+    FILE *fp = NULL;
+
+    while (read_line(stdin, line)) {
+        /*
+         * Streamed output can show up between the logs of tests
+         */
+        if ((state == scanning_for_name || state == scanning_for_sep) &&
+            parse_stream_line(line, name, text)) {
+            streams[name].push_back(text);
+            continue;
+        }
+
+        switch (state) {
+        case scanning_for_start:
+            if (starts_with(line, "Running limpet")) {
+                state = scanning_for_name;
+            } else if (starts_with(line, "{")) {
+                if (!listed) {
+                    output = prefix + "list";
+                    fp = open_output(output);
+                    listed = true;
+                }
+                write_line(fp, line);
+            }
+            break;
+
+        case scanning_for_name:
+            if (starts_with(line, "> Log for ")) {
+                output = prefix +
+                    log_file_name(line.substr(strlen("> Log for ")));
+                fp = open_output(output);
+                state = scanning_for_log;
+            } else if (starts_with(line, "> Ran ")) {
+                output = prefix + "summary";
+                fp = open_output(output);
+                write_line(fp, line);
+                state = scanning_for_end;
+            } else {
+                check_for_unexpected(line);
+            }
+            break;
+
+        case scanning_for_log:
+            if (is_rule(line, "> ", 'v')) {
+                write_line(fp, line);
+                state = scanning_log;
+            } else {
+                check_for_unexpected(line);
+            }
+            break;
+
+        case scanning_log:
+            if (is_rule(line, "> ", '^')) {
+                state = scanning_for_status;
+            }
+            write_line(fp, line);
+            break;
+
+        case scanning_for_status:
+            if (starts_with(line, "> Test complete: ")) {
+                write_line(fp, line);
+                state = scanning_for_sep;
+            } else {
+                check_for_unexpected(line);
+            }
+            break;
+
+        case scanning_for_sep:
+            if (line == "---") {
+                close_output(fp, output);
+                fp = NULL;
+                state = scanning_for_name;
+            } else if (starts_with(line, "> Perf: ")) {
+                write_line(fp, mask_figures(drop_hardware_counters(line)));
+            } else if (is_trailer(line)) {
+                write_line(fp, mask_figures(line));
+            } else {
+                fprintf(stderr, "Unexpected line after test status: %s\n",
+                    line.c_str());
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case scanning_for_end:
+            check_for_unexpected(line);
+            write_line(fp, line);
+            break;
+        }
+    }
+
+    close_output(fp, output);
+    write_streams(prefix + "stream", streams);
+
+    /*
+     * Tests that were listed aren't run, so there is no summary
+     */
+    if (listed && state == scanning_for_start) {
+        return EXIT_SUCCESS;
+    }
+
+    if (state != scanning_for_end) {
+        fprintf(stderr, "End state was '%s' not 'scanning_for_end'\n",
+            state_names[state]);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Get the names of the files in a directory that start with the given
+ * prefix
+ */
+static void find_files(const char *dir, const std::string &prefix,
+    std::set<std::string> &names) {
+    struct dirent *entry;
+    DIR *dp;
+
+    dp = opendir(dir);
+    if (dp == NULL) {
+        fprintf(stderr, "Unable to open %s: %s\n", dir, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    while ((entry = readdir(dp)) != NULL) {
+        if (strncmp(entry->d_name, prefix.c_str(), prefix.size()) == 0) {
+            names.insert(entry->d_name);
+        }
+    }
+
+    closedir(dp);
+}
+
+/*
+ * Hash the contents of a file with FNV-1a
+ * size - set to the size of the file
+ *
+ * Returns: true on success, false if the file couldn't be read
+ */
+static bool hash_file(const std::string &path, uint64_t *hash,
+    uint64_t *size) {
+    static char buf[READ_SIZE];
+    size_t n;
+    FILE *fp;
+
+    fp = fopen(path.c_str(), "r");
+    if (fp == NULL) {
+        return false;
+    }
+
+    *hash = 14695981039346656037u;
+    *size = 0;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) != 0) {
+        size_t i;
+
+        for (i = 0; i < n; i++) {
+            *hash ^= (unsigned char)buf[i];
+            *hash *= 1099511628211u;
+        }
+        *size += n;
+    }
+
+    fclose(fp);
+
+    return true;
+}
+
+static bool ends_with(const std::string &s, const char *suffix) {
+    size_t len = strlen(suffix);
+
+    return s.size() >= len && s.compare(s.size() - len, len, suffix) == 0;
+}
+
+/*
+ * Replace each tab-separated field of a file that is a number with "N"
+ */
+static void mask_numbers(const std::string &path) {
+    std::vector<std::string> lines;
+    char *buf = NULL;
+    size_t buf_size = 0;
+    ssize_t len;
+    FILE *fp;
+
+    fp = fopen(path.c_str(), "r");
+    if (fp == NULL) {
+        return;
+    }
+
+    while ((len = getline(&buf, &buf_size, fp)) != -1) {
+        std::string line(buf, len);
+        std::string masked;
+        size_t start;
+
+        for (start = 0; start < line.size(); ) {
+            size_t end = line.find_first_of("\t\n", start);
+            std::string field;
+
+            if (end == std::string::npos) {
+                end = line.size();
+            }
+            field = line.substr(start, end - start);
+            if (!field.empty() &&
+                field.find_first_not_of("0123456789.") == std::string::npos) {
+                field = "N";
+            }
+            masked += field;
+            if (end < line.size()) {
+                masked += line[end];
+            }
+            start = end + 1;
+        }
+        lines.push_back(masked);
+    }
+
+    free(buf);
+    fclose(fp);
+
+    fp = open_output(path);
+    for (const std::string &line : lines) {
+        fputs(line.c_str(), fp);
+    }
+    close_output(fp, path);
+}
+
+/*
+ * Names of the figures in reports that differ from run to run
+ */
+static const char *report_figures[] = {
+    "duration", "user", "sys", "maxrss_kib", "majflt", "minflt", "nvcsw",
+    "nivcsw",
+};
+
+/*
+ * Replace each number in a line that follows the given text with "N"
+ */
+static void mask_after(std::string &line, const std::string &text) {
+    size_t pos;
+
+    for (pos = line.find(text); pos != std::string::npos;
+        pos = line.find(text, pos)) {
+        size_t start = pos + text.size();
+        size_t end = line.find_first_not_of("0123456789.", start);
+
+        if (end == std::string::npos) {
+            end = line.size();
+        }
+        if (end != start) {
+            line.replace(start, end - start, "N");
+        }
+        pos = start;
+    }
+}
+
+/*
+ * Mask the figures in a report written in JSON Lines, TAP or JUnit XML and
+ * remove the current directory from the names of files
+ */
+static void mask_report(const std::string &path) {
+    std::vector<std::string> lines;
+    std::string cwd;
+    char *buf = NULL;
+    size_t buf_size = 0;
+    ssize_t len;
+    FILE *fp;
+
+    fp = fopen(path.c_str(), "r");
+    if (fp == NULL) {
+        return;
+    }
+
+    buf = getcwd(NULL, 0);
+    if (buf != NULL) {
+        cwd = std::string(buf) + "/";
+        free(buf);
+        buf = NULL;
+    }
+
+    while ((len = getline(&buf, &buf_size, fp)) != -1) {
+        std::string line(buf, len);
+        size_t pos;
+
+        for (const char *figure : report_figures) {
+            std::string name(figure);
+
+            mask_after(line, "\"" + name + "\":");
+            mask_after(line, "  " + name + ": ");
+            mask_after(line, "name=\"" + name + "\" value=\"");
+        }
+        mask_after(line, " time=\"");
+
+        if (!cwd.empty()) {
+            while ((pos = line.find(cwd)) != std::string::npos) {
+                line.erase(pos, cwd.size());
+            }
+        }
+        lines.push_back(line);
+    }
+
+    free(buf);
+    fclose(fp);
+
+    fp = open_output(path);
+    for (const std::string &line : lines) {
+        fputs(line.c_str(), fp);
+    }
+    close_output(fp, path);
+}
+
+static bool file_exists(const std::string &path) {
+    return access(path.c_str(), F_OK) == 0;
+}
+
+static int check(bool verbose, const char *actual_dir, const char *tests) {
+    std::vector<std::string> test_names;
+    const char *p;
+    unsigned errors = 0;
+
+    for (p = tests; *p != '\0';) {
+        size_t len;
+
+        p += strspn(p, " \t\n");
+        len = strcspn(p, " \t\n");
+        if (len != 0) {
+            test_names.push_back(std::string(p, len));
+        }
+        p += len;
+    }
+
+    for (const std::string &test : test_names) {
+        std::set<std::string> files;
+
+        find_files(actual_dir, test + ".", files);
+        find_files(CANONICAL, test + ".", files);
+
+        for (const std::string &file : files) {
+            std::string actual = std::string(actual_dir) + "/" + file;
+            std::string canonical = std::string(CANONICAL) + "/" + file;
+            uint64_t actual_hash, canonical_hash;
+            uint64_t actual_size, canonical_size;
+
+            if (!file_exists(actual)) {
+                printf("Expected file %s was not produced\n", file.c_str());
+                errors++;
+                continue;
+            }
+
+            if (ends_with(file, ".tsv")) {
+                mask_numbers(actual);
+            } else if (ends_with(file, ".jsonl") || ends_with(file, ".tap") ||
+                ends_with(file, ".xml")) {
+                mask_report(actual);
+            }
+
+            if (!file_exists(canonical)) {
+                printf("File %s was not expected\n", file.c_str());
+                errors++;
+                continue;
+            }
+
+            if (hash_file(actual, &actual_hash, &actual_size) &&
+                hash_file(canonical, &canonical_hash, &canonical_size) &&
+                actual_size == canonical_size &&
+                actual_hash == canonical_hash) {
+                printf("Test %s(%s) passed\n", test.c_str(), file.c_str());
+                continue;
+            }
+
+            if (verbose) {
+                std::string cmd = "diff '" + canonical + "' '" + actual + "'";
+
+                fflush(stdout);
+                if (system(cmd.c_str()) == -1) {
+                    fprintf(stderr, "Unable to run diff: %s\n",
+                        strerror(errno));
+                }
+            }
+
+            printf("Test %s(%s) failed. See %s\n", test.c_str(),
+                file.c_str(), actual.c_str());
+            errors++;
+        }
+    }
+
+    printf("Actual output in %s, expected output in %s\n", actual_dir,
+        CANONICAL);
+
+    if (errors != 0) {
+        printf("Tests FAILED\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("Tests PASSED\n");
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        usage();
+    }
+
+    if (strcmp(argv[1], "parse") == 0) {
+        if (argc != 4) {
+            usage();
+        }
+        return parse(argv[2], argv[3]);
+    }
+
+    if (strcmp(argv[1], "check") == 0) {
+        bool verbose = false;
+        int arg = 2;
+
+        if (arg < argc && strcmp(argv[arg], "-v") == 0) {
+            verbose = true;
+            arg++;
+        }
+
+        if (argc - arg != 2) {
+            usage();
+        }
+        return check(verbose, argv[arg], argv[arg + 1]);
+    }
+
+    usage();
+}
@@ -0,0 +1,36 @@
+/*
+ * Test for many tests streaming output at the same time. The supervisor is
+ * busy printing their lines while tests are being started, which used to
+ * leave tests started with clone3() waiting forever for a stdio lock it
+ * held.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <limpet.h>
+
+int main(int argc, char *argv[]) {
+    fprintf(stderr, "Should never get to main()\n");
+    exit(EXIT_FAILURE);
+}
+
+#ifdef LIMPET
+/*
+ * The number of lines each writer prints
+ */
+static const unsigned n_lines[] = {
+    100, 100, 100, 100, 100, 100, 100, 100,
+    100, 100, 100, 100, 100, 100, 100, 100,
+    100, 100, 100, 100, 100, 100, 100, 100,
+    100, 100, 100, 100, 100, 100, 100, 100,
+};
+
+LIMPET_TEST_P(writer, n_lines) {
+    unsigned i;
+
+    for (i = 0; i < limpet_param; i++) {
+        printf("line %u\n", i);
+    }
+}
+#endif /* LIMPET */